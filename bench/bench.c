@@ -0,0 +1,164 @@
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/personality.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Lua seeds the hashes of strings with time() and the addresses of the state
+ * and of a local variable, which place the same keys differently in each run.
+ * How fast tables are read changes with it, by up to half in the deep corpus,
+ * so the host makes the seed the same every time: this time() replaces the C
+ * library's for Lua, main runs without address randomization, and Lua runs on
+ * a static stack, as the main one starts lower the longer the environment is.
+ */
+time_t time(time_t *t) {
+    if (t)
+        *t = 0;
+    return 0;
+}
+
+struct alloc_stats {
+    size_t count;
+    size_t bytes;
+    size_t peak;
+};
+
+static struct alloc_stats stats;
+
+static void *
+counting_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    struct alloc_stats *st = (struct alloc_stats *)ud;
+    // osize is a type tag instead of a size when ptr is NULL
+    size_t old = ptr ? osize : 0;
+    if (nsize == 0) {
+        free(ptr);
+        st->bytes -= old;
+        return NULL;
+    }
+    void *p = realloc(ptr, nsize);
+    if (p == NULL)
+        return NULL;
+    st->count++;
+    st->bytes += nsize - old;
+    if (st->bytes > st->peak)
+        st->peak = st->bytes;
+    return p;
+}
+
+// returns allocation count, current bytes and peak bytes
+static int
+bench_alloc(lua_State *L) {
+    lua_pushnumber(L, (lua_Number)stats.count);
+    lua_pushnumber(L, (lua_Number)stats.bytes);
+    lua_pushnumber(L, (lua_Number)stats.peak);
+    return 3;
+}
+
+static int
+bench_reset(lua_State *L) {
+    stats.count = 0;
+    stats.peak = stats.bytes;
+    (void)L;
+    return 0;
+}
+
+static int
+bench_clock(lua_State *L) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    lua_pushnumber(L, (lua_Number)ts.tv_sec + (lua_Number)ts.tv_nsec / 1e9);
+    return 1;
+}
+
+// copies the string once, the speed every encoder is bounded by
+static char *copy;
+static size_t copy_size;
+
+static int
+bench_memcpy(lua_State *L) {
+    size_t len;
+    const char *s = luaL_checklstring(L, 1, &len);
+    if (len > copy_size) {
+        char *p = realloc(copy, len);
+        if (p == NULL)
+            return luaL_error(L, "out of memory");
+        copy = p;
+        copy_size = len;
+    }
+    memcpy(copy, s, len);
+    return 0;
+}
+
+struct script {
+    int argc;
+    char **argv;
+    int status;
+};
+
+static void *
+run_script(void *ud) {
+    struct script *sc = (struct script *)ud;
+    lua_State *L = lua_newstate(counting_alloc, &stats);
+    luaL_openlibs(L);
+
+    lua_register(L, "bench_alloc", bench_alloc);
+    lua_register(L, "bench_reset", bench_reset);
+    lua_register(L, "bench_clock", bench_clock);
+    lua_register(L, "bench_memcpy", bench_memcpy);
+
+    lua_newtable(L);
+    for (int i = 0; i < sc->argc - 1; ++i) {
+        lua_pushstring(L, sc->argv[i + 1]);
+        lua_rawseti(L, -2, i);
+    }
+    lua_setglobal(L, "arg");
+
+    int status = luaL_dofile(L, sc->argv[1]);
+    if (status != 0) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    } else {
+        // a number returned by the script is the exit status
+        status = lua_isnumber(L, -1) ? (int)lua_tonumber(L, -1) : 0;
+    }
+    lua_close(L);
+    sc->status = status;
+    return NULL;
+}
+
+static char lua_stack[16 << 20] __attribute__((aligned(4096)));
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s script [args]\n", argv[0]);
+        return 1;
+    }
+
+#ifdef __linux__
+    int persona = personality(0xffffffff);
+    if (persona != -1 && !(persona & ADDR_NO_RANDOMIZE) && personality(persona | ADDR_NO_RANDOMIZE) != -1) {
+        execv("/proc/self/exe", argv);
+        // runs randomized if it can't start again
+    }
+#endif
+
+    struct script sc = {argc, argv, 1};
+    pthread_attr_t attr;
+    pthread_t thread;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, lua_stack, sizeof(lua_stack));
+    if (pthread_create(&thread, &attr, run_script, &sc) != 0) {
+        fprintf(stderr, "can't start the script\n");
+        return 1;
+    }
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+    return sc.status;
+}
@@ -0,0 +1,346 @@
+-- Usage: bench/bench bench/bench.lua result.json [baseline.json [tolerance]]
+-- Runs under bench/bench, which provides bench_clock, bench_alloc, bench_reset and bench_memcpy.
+
+package.cpath = "./?.so;" .. package.cpath
+local cseri = require "cseri"
+
+if not load or not pcall(load, "") then load = loadstring end
+
+local output, baseline = arg[1], arg[2]
+local tolerance = tonumber(arg[3]) or 0.1
+-- each time is the best of RUNS samples of at least MIN_TIME seconds
+local RUNS, MIN_TIME = 8, 0.1
+
+-- speeds compare only on the same CPU, allocations only on the same Lua
+local function cpu()
+    local f = io.open("/proc/cpuinfo", "r")
+    local model = f and f:read("*a"):match("model name%s*:%s*([^\n]+)")
+    if f then f:close() end
+    return model or "unknown"
+end
+local machine = {cpu = cpu(), lua = _VERSION}
+
+-- the corpus must not depend on math.random, which differs between Lua versions
+local seed = 42
+local function random(n)
+    seed = (seed * 1103515245 + 12345) % 2147483648
+    return seed % n + 1
+end
+
+local function random_string(len)
+    local chars = {}
+    for i = 1, len do
+        chars[i] = string.char(31 + random(95))
+    end
+    return table.concat(chars)
+end
+
+local corpus = {}
+
+-- many records of a dozen fields
+do
+    local t = {}
+    for i = 1, 20000 do
+        t[i] = {
+            id = i, name = random_string(12), level = random(100), exp = random(1000000),
+            hp = random(10000) / 7, active = random(2) == 1, tags = {"a", "b", "c"},
+            pos = {x = random(1000) / 3, y = random(1000) / 3, z = 0},
+            guild = random_string(8), score = random(2147483647) * 1000,
+        }
+    end
+    corpus[#corpus + 1] = {name = "wide", data = t}
+end
+
+-- binary trees as deep as tobin allows
+do
+    local function tree(depth)
+        if depth == 0 then
+            return random(100)
+        end
+        return {left = tree(depth - 1), right = tree(depth - 1), n = depth}
+    end
+    local t = {}
+    for i = 1, 8 do
+        t[i] = tree(14)
+    end
+    local p = t[1]
+    for i = 1, 28 do
+        p.next = {i}
+        p = p.next
+    end
+    corpus[#corpus + 1] = {name = "deep", data = t}
+end
+
+-- string keys and values, with characters to escape
+do
+    local t = {}
+    for i = 1, 50000 do
+        t[random_string(random(24))] = random_string(random(40)) .. "\n\"\\"
+    end
+    corpus[#corpus + 1] = {name = "strings", data = t}
+end
+
+-- integers of every width and floats
+do
+    local t = {}
+    for i = 1, 500000 do
+        local r = random(4)
+        if r == 1 then
+            t[i] = random(200)
+        elseif r == 2 then
+            t[i] = random(60000)
+        elseif r == 3 then
+            t[i] = random(2147483647) * 4096
+        else
+            t[i] = random(1000000) / 1024
+        end
+    end
+    corpus[#corpus + 1] = {name = "numbers", data = t}
+end
+
+-- strings longer than 64 KB
+do
+    local t = {}
+    for i = 1, 16 do
+        t[i] = string.rep(random_string(1024), 64 + random(64))
+    end
+    corpus[#corpus + 1] = {name = "long", data = t}
+end
+
+-- one flat array of a million scalars, where reading the table dominates
+do
+    local t = {}
+    for i = 1, 1000000 do
+        t[i] = random(2) == 1 and random(1000000) or random(1000000) / 8
+    end
+    corpus[#corpus + 1] = {name = "array", data = t}
+end
+
+-- the reference for totxt: the usual serializer written in Lua
+local function lua_serialize(v, out)
+    local tv = type(v)
+    if tv == "table" then
+        out[#out + 1] = "{"
+        local n = #v
+        for i = 1, n do
+            lua_serialize(v[i], out)
+            out[#out + 1] = ","
+        end
+        for k, x in pairs(v) do
+            if not (type(k) == "number" and k % 1 == 0 and k >= 1 and k <= n) then
+                if type(k) == "string" and k:match("^[%a_][%w_]*$") then
+                    out[#out + 1] = k
+                    out[#out + 1] = "="
+                else
+                    out[#out + 1] = "["
+                    lua_serialize(k, out)
+                    out[#out + 1] = "]="
+                end
+                lua_serialize(x, out)
+                out[#out + 1] = ","
+            end
+        end
+        out[#out + 1] = "}"
+    elseif tv == "string" then
+        out[#out + 1] = string.format("%q", v)
+    else
+        out[#out + 1] = tostring(v)
+    end
+end
+
+local function identity(t) return t end
+local function output_size(run) return function(t) return #run(t) end end
+local function input_size(s) return #s end
+
+-- bytes is the size of the serialized data each run produces or consumes
+local codecs = {
+    {name = "tobin", prepare = identity, run = cseri.tobin, bytes = output_size(cseri.tobin)},
+    {name = "frombin", prepare = cseri.tobin, run = cseri.frombin, bytes = input_size},
+    {name = "toframe", prepare = identity, run = cseri.toframe, bytes = output_size(cseri.toframe)},
+    {name = "fromframe", prepare = cseri.toframe, run = function(s) return cseri.fromframe(s) end,
+        bytes = input_size},
+    {name = "canonbin", prepare = identity, run = cseri.canonbin, bytes = output_size(cseri.canonbin)},
+    {name = "hash", prepare = identity, run = cseri.hash, bytes = output_size(cseri.canonbin)},
+    {name = "totxt", prepare = identity, run = cseri.totxt, bytes = output_size(cseri.totxt)},
+    {name = "canontxt", prepare = identity, run = cseri.canontxt, bytes = output_size(cseri.canontxt)},
+    {name = "luatxt", prepare = identity, bytes = output_size(cseri.totxt),
+        run = function(t) local out = {} lua_serialize(t, out) return table.concat(out) end},
+    {name = "load", prepare = function(t) return "return " .. cseri.totxt(t) end,
+        run = function(s) return load(s)() end, bytes = input_size},
+}
+
+-- copying the output of tobin is what the encoders are bounded by
+table.insert(codecs, 2, {name = "memcpy", prepare = cseri.tobin, run = bench_memcpy, bytes = input_size})
+
+-- make bench LUA_SRC=... builds the internals flavor as cseri_raw
+local has_raw, cseri_raw = pcall(require, "cseri_raw")
+if has_raw then
+    table.insert(codecs, 2, {name = "tobin_raw", prepare = identity, run = cseri_raw.tobin,
+        bytes = output_size(cseri_raw.tobin)})
+end
+
+-- the first run after another case pays for what that case left, such as freeing its garbage
+local function sample(run, input)
+    collectgarbage("collect")
+    run(input)
+    collectgarbage("collect")
+    local count = 0
+    local start = bench_clock()
+    local elapsed
+    repeat
+        run(input)
+        count = count + 1
+        elapsed = bench_clock() - start
+    until elapsed >= MIN_TIME
+    return elapsed / count
+end
+
+local function allocations(run, input)
+    collectgarbage("collect")
+    local _, base = bench_alloc()
+    bench_reset()
+    run(input)
+    local count, _, peak = bench_alloc()
+    return count, peak - base
+end
+
+local cases = {}
+for _, c in ipairs(corpus) do
+    local objects = cseri.inspect(cseri.tobin(c.data))
+    for _, codec in ipairs(codecs) do
+        local input = codec.prepare(c.data)
+        cases[#cases + 1] = {corpus = c, codec = codec, input = input, bytes = codec.bytes(input),
+            objects = objects, time = math.huge}
+    end
+end
+
+-- noise only makes a sample slower, so the fastest is the closest to the real time. A round takes
+-- one sample of every case, so a slow spell of the machine costs each case a sample, not all of them
+for _ = 1, RUNS do
+    for _, case in ipairs(cases) do
+        case.time = math.min(case.time, sample(case.codec.run, case.input))
+    end
+end
+
+local results = {}
+local times = {}
+for _, case in ipairs(cases) do
+    local name, codec, time, bytes, objects = case.corpus.name, case.codec.name, case.time, case.bytes, case.objects
+    local allocs, peak = allocations(case.codec.run, case.input)
+    times[name] = times[name] or {}
+    times[name][codec] = time
+    results[#results + 1] = {
+        codec = codec, corpus = name,
+        mbps = bytes / time / 1e6, ns_per_object = time * 1e9 / objects,
+        allocs = allocs, peak_bytes = peak,
+    }
+    io.stderr:write(string.format("%-9s %-8s %10.2f MB/s %10.2f ns/object %10d allocs %12d peak bytes\n",
+        codec, name, bytes / time / 1e6, time * 1e9 / objects, allocs, peak))
+end
+
+-- toframe costs tobin plus the CRC32C; luatxt is the baseline for totxt
+local comparisons = {}
+for _, c in ipairs(corpus) do
+    local t = times[c.name]
+    -- below 5% the difference is noise, and the speed of the CRC would be made up
+    local overhead = t.toframe / t.tobin - 1
+    local crc = overhead > 0.05 and #cseri.toframe(c.data) / (t.toframe - t.tobin) / 1e6
+    local raw = has_raw and t.tobin / t.tobin_raw or 0
+    comparisons[#comparisons + 1] = string.format(
+        '{"corpus": "%s", "frame_overhead": %.3f, "crc_mbps": %s, "totxt_speedup": %.3f, "of_memcpy": %.3f, "raw_speedup": %.3f}',
+        c.name, overhead, crc and string.format("%.3f", crc) or "null", t.luatxt / t.totxt, t.memcpy / t.tobin, raw)
+    io.stderr:write(string.format("%-8s toframe %+.1f%% over tobin (%s), totxt %.2f times as fast as Lua, tobin at %.1f%% of memcpy\n",
+        c.name, overhead * 100, crc and string.format("CRC at %.0f MB/s", crc) or "CRC within noise",
+        t.luatxt / t.totxt, t.memcpy / t.tobin * 100))
+    if has_raw then
+        io.stderr:write(string.format("%-8s tobin_raw %.2f times as fast as tobin, at %.1f%% of memcpy\n",
+            c.name, raw, t.memcpy / t.tobin_raw * 100))
+    end
+end
+
+local function format_result(r)
+    return string.format('{"codec": "%s", "corpus": "%s", "mbps": %.3f, "ns_per_object": %.3f, "allocs": %d, "peak_bytes": %d}',
+        r.codec, r.corpus, r.mbps, r.ns_per_object, r.allocs, r.peak_bytes)
+end
+
+local lines = {}
+for i, r in ipairs(results) do
+    lines[i] = "    " .. format_result(r)
+end
+local f = assert(io.open(output, "w"))
+f:write(string.format('{\n  "machine": {"cpu": "%s", "lua": "%s"},\n', machine.cpu, machine.lua))
+f:write('  "results": [\n', table.concat(lines, ",\n"), '\n  ],\n  "comparisons": [\n    ',
+    table.concat(comparisons, ",\n    "), "\n  ]\n}\n")
+f:close()
+
+if not baseline then
+    return 0
+end
+
+-- reads back what format_result writes, one result per line
+local f = io.open(baseline, "r")
+if not f then
+    io.stderr:write("warning: no baseline at ", baseline, ", make bench-baseline records one\n")
+    return 0
+end
+local base = {}
+local base_machine = {}
+for line in f:lines() do
+    local cpu, lua = line:match('"machine": {"cpu": "(.-)", "lua": "(.-)"}')
+    if cpu then
+        base_machine = {cpu = cpu, lua = lua}
+    end
+    local codec, name, mbps, ns, allocs, peak = line:match(
+        '"codec": "(.-)", "corpus": "(.-)", "mbps": ([%d.]+), "ns_per_object": ([%d.]+), "allocs": (%d+), "peak_bytes": (%-?%d+)')
+    if codec then
+        base[codec .. "/" .. name] = {mbps = tonumber(mbps), allocs = tonumber(allocs), peak_bytes = tonumber(peak)}
+    end
+end
+f:close()
+
+local same_cpu = base_machine.cpu == machine.cpu
+local same_lua = base_machine.lua == machine.lua
+local skipped = {}
+if not same_cpu then skipped[#skipped + 1] = "MB/s" end
+if not same_lua then skipped[#skipped + 1] = "allocs and peak bytes" end
+if #skipped > 0 then
+    io.stderr:write(string.format("warning: baseline recorded on %s with %s, %s not compared\n",
+        base_machine.cpu or "an unknown CPU", base_machine.lua or "an unknown Lua", table.concat(skipped, ", ")))
+end
+
+local regressions, compared = 0, 0
+for i, r in ipairs(results) do
+    local b = base[r.codec .. "/" .. r.corpus]
+    if not b then
+        io.stderr:write("no baseline for ", r.codec, " ", r.corpus, "\n")
+    else
+        compared = compared + 1
+        -- a slow spell may outlast a round, so a case that looks slower is sampled until it isn't
+        local mbps, case = r.mbps, cases[i]
+        for _ = 1, same_cpu and RUNS * 4 or 0 do
+            if mbps >= b.mbps * (1 - tolerance) then
+                break
+            end
+            case.time = math.min(case.time, sample(case.codec.run, case.input))
+            mbps = case.bytes / case.time / 1e6
+        end
+        local checks = {
+            {"MB/s", same_cpu and mbps < b.mbps * (1 - tolerance), b.mbps, mbps},
+            {"allocs", same_lua and r.allocs > b.allocs * (1 + tolerance), b.allocs, r.allocs},
+            {"peak bytes", same_lua and r.peak_bytes > b.peak_bytes * (1 + tolerance), b.peak_bytes, r.peak_bytes},
+        }
+        for _, check in ipairs(checks) do
+            if check[2] then
+                regressions = regressions + 1
+                io.stderr:write(string.format("regression: %s %s %s %.2f -> %.2f\n",
+                    r.codec, r.corpus, check[1], check[3], check[4]))
+            end
+        end
+    end
+end
+
+if compared == 0 then
+    io.stderr:write("nothing compared with the baseline\n")
+    return 1
+end
+return regressions > 0 and 1 or 0
@@ -2,8 +2,15 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include "common.h"
 #include "buffer.h"
+#include "codec.h"
+#include "crc32c.h"
+#include "hash.h"
+#include "rawtable.h"
+#include "sortkeys.h"
+#include "stats.h"
 
 #define TYPE_NIL 0
 #define TYPE_BOOLEAN 1
@@ -19,6 +26,9 @@
 #define TYPE_NUMBER_REAL 8
 
 #define TYPE_USERDATA 3
+// hibits 0 : tag and string from the codec, 1 : tag and table
+#define TYPE_USERDATA_NATIVE 0
+#define TYPE_USERDATA_TABLE 1
 #define TYPE_SHORT_STRING 4
 // hibits 0~31 : len
 #define TYPE_LONG_STRING 5
@@ -107,13 +117,10 @@ append_real(struct buffer *bf, double v) {
 }
 
 static inline void
-append_string(struct buffer *bf, const char *str, int len) {
+append_string_header(struct buffer *bf, int len) {
     if (len < MAX_COOKIE) {
         uint8_t n = COMBINE_TYPE(TYPE_SHORT_STRING, len);
         buffer_append(bf, &n, 1);
-        if (len > 0) {
-            buffer_append(bf, str, len);
-        }
     } else {
         uint8_t n;
         if (len < 0x10000) {
@@ -129,15 +136,21 @@ append_string(struct buffer *bf, const char *str, int len) {
             CONVERT(x);
             buffer_append(bf, &x, 4);
         }
+    }
+}
+
+static inline void
+append_string(struct buffer *bf, const char *str, int len) {
+    append_string_header(bf, len);
+    if (len > 0) {
         buffer_append(bf, str, len);
     }
 }
 
-static void pack_one(lua_State *L, struct buffer *b, int index, int depth);
+static void pack_one(lua_State *L, struct buffer *b, int index, int depth, int sorted);
 
-static int
-append_table_array(lua_State *L, struct buffer *bf, int index, int depth) {
-    int array_size = lua_rawlen(L,index);
+static void
+append_table_header(struct buffer *bf, int array_size) {
     if (array_size >= MAX_COOKIE-1) {
         int n = COMBINE_TYPE(TYPE_TABLE, MAX_COOKIE-1);
         buffer_append(bf, &n, 1);
@@ -146,20 +159,26 @@ append_table_array(lua_State *L, struct buffer *bf, int index, int depth) {
         int n = COMBINE_TYPE(TYPE_TABLE, array_size);
         buffer_append(bf, &n, 1);
     }
+}
+
+static int
+append_table_array(lua_State *L, struct buffer *bf, int index, int depth, int sorted) {
+    int array_size = sorted ? sequence_length(L,index) : (int)lua_rawlen(L,index);
+    append_table_header(bf, array_size);
 
     int i;
     for (i=1;i<=array_size;i++) {
         lua_rawgeti(L,index,i);
-        pack_one(L, bf, -1, depth);
+        pack_one(L, bf, -1, depth, sorted);
         lua_pop(L,1);
     }
 
     return array_size;
 }
 
+// packs the pairs following the key on the top of the stack
 static void
-append_table_hash(lua_State *L, struct buffer *bf, int index, int depth, int array_size) {
-    lua_pushnil(L);
+append_table_next(lua_State *L, struct buffer *bf, int index, int depth, int array_size) {
     while (lua_next(L, index) != 0) {
         if (lua_type(L,-2) == LUA_TNUMBER) {
             if (lua_isinteger(L, -2)) {
@@ -170,25 +189,223 @@ append_table_hash(lua_State *L, struct buffer *bf, int index, int depth, int arr
                 }
             }
         }
-        pack_one(L,bf,-2,depth);
-        pack_one(L,bf,-1,depth);
+        pack_one(L,bf,-2,depth,0);
+        pack_one(L,bf,-1,depth,0);
         lua_pop(L, 1);
     }
+}
+
+static void
+append_table_hash(lua_State *L, struct buffer *bf, int index, int depth, int array_size) {
+    lua_pushnil(L);
+    append_table_next(L, bf, index, depth, array_size);
+    append_nil(bf);
+}
+
+#ifdef RAWTABLE
+
+static void
+append_raw(struct buffer *bf, const struct raw_scalar *s) {
+    switch (s->type) {
+    case LUA_TNIL:
+        append_nil(bf);
+        break;
+    case LUA_TBOOLEAN:
+        append_boolean(bf, (int)s->i);
+        break;
+    case LUA_TNUMBER:
+        if (s->isint)
+            append_integer(bf, s->i);
+        else
+            append_real(bf, s->n);
+        break;
+    default:
+        STAT_ADD(bf, strings, 1);
+        append_string(bf, s->str, (int)s->len);
+    }
+}
+
+static void
+push_raw(lua_State *L, const struct raw_scalar *s) {
+    switch (s->type) {
+    case LUA_TBOOLEAN:
+        lua_pushboolean(L, (int)s->i);
+        break;
+    case LUA_TNUMBER:
+        if (s->isint)
+            lua_pushinteger(L, s->i);
+        else
+            lua_pushnumber(L, s->n);
+        break;
+    default:
+        lua_pushlstring(L, s->str, s->len);
+    }
+}
+
+static int
+raw_keys_scalar(const Table *t) {
+    struct raw_scalar key;
+    for (unsigned int i = 0; i < raw_node_size(t); ++i) {
+        const Node *n = raw_node(t, i);
+        if (!raw_isnil(raw_node_value(n)) && !raw_key(n, &key))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Same output as append_table_array and append_table_hash, but scalars are read
+ * from the array and node parts directly. Only tables and userdata go through
+ * the stack, and the node part is skipped when it's empty.
+ */
+static void
+pack_raw_table(lua_State *L, struct buffer *bf, int index, int depth) {
+    // lua_rawlen may update alimit in Lua 5.4, so call it first
+    int array_size = (int)lua_rawlen(L,index);
+    const Table *t = raw_table(L, index);
+    unsigned int asize = raw_asize(t);
+    append_table_header(bf, array_size);
+
+    struct raw_scalar s;
+    for (int i = 1; i <= array_size; i++) {
+        if ((unsigned int)i <= asize && raw_value(raw_array(t, i - 1), &s)) {
+            append_raw(bf, &s);
+        } else {
+            lua_rawgeti(L,index,i);
+            pack_one(L, bf, -1, depth, 0);
+            lua_pop(L,1);
+        }
+    }
+
+    // the rest of the array part, which lua_next visits before the nodes
+    for (unsigned int i = array_size; i < asize; i++) {
+        const TValue *v = raw_array(t, i);
+        if (raw_isnil(v))
+            continue;
+        append_integer(bf, (lua_Integer)i + 1);
+        if (raw_value(v, &s)) {
+            append_raw(bf, &s);
+        } else {
+            lua_rawgeti(L,index,(lua_Integer)i + 1);
+            pack_one(L, bf, -1, depth, 0);
+            lua_pop(L,1);
+        }
+    }
+
+    if (raw_has_nodes(t)) {
+        if (!raw_keys_scalar(t)) {
+            // resume lua_next from the last array slot to visit the nodes only
+            if (asize > 0)
+                lua_pushinteger(L, asize);
+            else
+                lua_pushnil(L);
+            append_table_next(L, bf, index, depth, array_size);
+        } else {
+            struct raw_scalar key;
+            for (unsigned int i = 0; i < raw_node_size(t); ++i) {
+                const Node *n = raw_node(t, i);
+                if (raw_isnil(raw_node_value(n)))
+                    continue;
+                raw_key(n, &key);
+                if (key.type == LUA_TNUMBER && key.isint && key.i > 0 && key.i <= array_size)
+                    continue;
+                append_raw(bf, &key);
+                if (raw_value(raw_node_value(n), &s)) {
+                    append_raw(bf, &s);
+                } else {
+                    push_raw(L, &key);
+                    lua_rawget(L, index);
+                    pack_one(L, bf, -1, depth, 0);
+                    lua_pop(L, 1);
+                }
+            }
+        }
+    }
     append_nil(bf);
 }
 
+#endif
+
 static void
-pack_table(lua_State *L, struct buffer *bf, int index, int depth) {
+append_table_sorted(lua_State *L, struct buffer *bf, int index, int depth, int array_size) {
+    struct sort_key *keys;
+    int n = sort_keys(L, index, array_size, &keys);
+    if (n < 0) {
+        buffer_free(bf);
+        luaL_error(L, "Canonical serialize supports only boolean, number and string keys");
+    }
+    int keys_table = lua_gettop(L) - 1;
+    for (int i = 0; i < n; ++i) {
+        lua_rawgeti(L, keys_table, keys[i].ref);
+        lua_pushvalue(L, -1);
+        lua_rawget(L, index);
+        pack_one(L,bf,-2,depth,1);
+        pack_one(L,bf,-1,depth,1);
+        lua_pop(L, 2);
+    }
+    if (n > 0)
+        lua_pop(L, 2);
+    append_nil(bf);
+}
+
+static void
+pack_table(lua_State *L, struct buffer *bf, int index, int depth, int sorted) {
     luaL_checkstack(L,LUA_MINSTACK,NULL);
+    STAT_ADD(bf, tables, 1);
+    STAT_MAX(bf, max_depth, depth);
     if (index < 0) {
         index = lua_gettop(L) + index + 1;
     }
-    int array_size = append_table_array(L, bf, index, depth);
-    append_table_hash(L, bf, index, depth, array_size);
+#ifdef RAWTABLE
+    // too deep tables go the generic way, which raises the error
+    if (!sorted && depth <= MAX_DEPTH) {
+        pack_raw_table(L, bf, index, depth);
+        return;
+    }
+#endif
+    int array_size = append_table_array(L, bf, index, depth, sorted);
+    if (sorted)
+        append_table_sorted(L, bf, index, depth, array_size);
+    else
+        append_table_hash(L, bf, index, depth, array_size);
+}
+
+static void
+pack_codec(lua_State *L, struct buffer *bf, int index, int depth, int sorted, const struct codec *c) {
+    int type = lua_type(L, index);
+    if (c->encode == NULL) {
+        if (type != LUA_TTABLE) {
+            buffer_free(bf);
+            luaL_error(L, "Unsupport type %s to serialize", lua_typename(L, type));
+        }
+        uint8_t n = COMBINE_TYPE(TYPE_USERDATA, TYPE_USERDATA_TABLE);
+        buffer_append(bf, &n, 1);
+        append_integer(bf, c->tag);
+        pack_table(L, bf, index, depth, sorted);
+        return;
+    }
+
+    uint8_t n = COMBINE_TYPE(TYPE_USERDATA, TYPE_USERDATA_NATIVE);
+    buffer_append(bf, &n, 1);
+    append_integer(bf, c->tag);
+    // the encoder writes in place, so the length is filled afterwards and always takes 4 bytes
+    struct buffer_mark mark;
+    uint8_t header[5];
+    buffer_reserve(bf, sizeof(header), &mark);
+    size_t start = buffer_size(bf);
+    if (c->encode(L, index, bf) != 0) {
+        buffer_free(bf);
+        luaL_error(L, "Can't serialize %s with tag %d", lua_typename(L, type), c->tag);
+    }
+    uint32_t len = (uint32_t)(buffer_size(bf) - start);
+    CONVERT(len);
+    header[0] = COMBINE_TYPE(TYPE_LONG_STRING, 4);
+    memcpy(header + 1, &len, 4);
+    buffer_fill(bf, &mark, (const char *)header, sizeof(header));
 }
 
 static void
-pack_one(lua_State *L, struct buffer *b, int index, int depth) {
+pack_one(lua_State *L, struct buffer *b, int index, int depth, int sorted) {
     if (depth > MAX_DEPTH) {
         buffer_free(b);
         luaL_error(L, "serialize can't pack too depth table");
@@ -212,16 +429,26 @@ pack_one(lua_State *L, struct buffer *b, int index, int depth) {
         append_boolean(b, lua_toboolean(L,index));
         break;
     case LUA_TSTRING: {
+        STAT_ADD(b, strings, 1);
         size_t sz = 0;
         const char *str = lua_tolstring(L,index,&sz);
         append_string(b, str, (int)sz);
         break;
     }
-    case LUA_TTABLE: {
+    case LUA_TTABLE:
+    case LUA_TUSERDATA: {
         if (index < 0) {
             index = lua_gettop(L) + index + 1;
         }
-        pack_table(L, b, index, depth+1);
+        const struct codec *c = codec_of(L, index);
+        if (c != NULL) {
+            pack_codec(L, b, index, depth+1, sorted, c);
+        } else if (type == LUA_TTABLE) {
+            pack_table(L, b, index, depth+1, sorted);
+        } else {
+            buffer_free(b);
+            luaL_error(L, "Unsupport type %s to serialize", lua_typename(L, type));
+        }
         break;
     }
     default:
@@ -230,37 +457,78 @@ pack_one(lua_State *L, struct buffer *b, int index, int depth) {
     }
 }
 
-int to_bin(lua_State *L) {
+static int
+pack_values(lua_State *L, int sorted) {
     struct buffer bf;
     buffer_initialize(&bf, L);
+    STAT_BEGIN(&bf);
 
     for (int i = 1; i <= lua_gettop(L); ++i) {
-        pack_one(L, &bf, i, 0);
+        pack_one(L, &bf, i, 0, sorted);
     }
 
     buffer_push_string(&bf);
     buffer_free(&bf);
+    STAT_END(&bf);
 
     return 1;
 }
 
+int to_bin(lua_State *L) {
+    return pack_values(L, 0);
+}
+
+int to_canonical_bin(lua_State *L) {
+    return pack_values(L, 1);
+}
+
+static void
+hash_sink(void *ud, const char *data, size_t len) {
+    hash64_update((struct hash64 *)ud, data, len);
+}
+
+int hash(lua_State *L) {
+    struct hash64 h;
+    hash64_init(&h, 0);
+
+    struct buffer bf;
+    buffer_initialize(&bf, L);
+    STAT_BEGIN(&bf);
+    buffer_sink(&bf, hash_sink, &h);
+
+    for (int i = 1; i <= lua_gettop(L); ++i) {
+        pack_one(L, &bf, i, 0, 1);
+    }
+
+    buffer_flush(&bf);
+    buffer_free(&bf);
+    STAT_ADD(&bf, bytes, h.total);
+    STAT_END(&bf);
+
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash64_digest(&h));
+    lua_pushlstring(L, hex, 16);
+    return 1;
+}
+
 struct reader {
     const char *buffer;
-    int len;
-    int ptr;
+    size_t len;
+    size_t ptr;
 };
 
-static void reader_init(struct reader *rd, const char *buffer, int size) {
+static void reader_init(struct reader *rd, const char *buffer, size_t size) {
     rd->buffer = buffer;
     rd->len = size;
     rd->ptr = 0;
 }
 
-static const void *reader_read(struct reader *rd, int size) {
+// sizes are unsigned, so a hostile length can't move ptr backward
+static const void *reader_read(struct reader *rd, size_t size) {
     if (rd->len < size)
         return NULL;
 
-    int ptr = rd->ptr;
+    size_t ptr = rd->ptr;
     rd->ptr += size;
     rd->len -= size;
     return rd->buffer + ptr;
@@ -268,7 +536,7 @@ static const void *reader_read(struct reader *rd, int size) {
 
 static inline void
 invalid_stream_line(lua_State *L, struct reader *rd, int line) {
-    luaL_error(L, "Invalid serialize stream %d (line:%d)", rd->ptr, line);
+    luaL_error(L, "Invalid serialize stream %d (line:%d)", (int)rd->ptr, line);
 }
 
 #define invalid_stream(L,rd) invalid_stream_line(L,rd,__LINE__)
@@ -330,7 +598,7 @@ get_real(lua_State *L, struct reader *rd) {
 }
 
 static void
-get_buffer(lua_State *L, struct reader *rd, int len) {
+get_buffer(lua_State *L, struct reader *rd, size_t len) {
     const char *p = reader_read(rd, len);
     if (p == NULL) {
         invalid_stream(L, rd);
@@ -338,25 +606,64 @@ get_buffer(lua_State *L, struct reader *rd, int len) {
     lua_pushlstring(L, p, len);
 }
 
-static void unpack_one(lua_State *L, struct reader *rd);
+static int
+get_count(lua_State *L, struct reader *rd) {
+    const uint8_t *t = reader_read(rd, sizeof(uint8_t));
+    if (t == NULL) {
+        invalid_stream(L,rd);
+    }
+    int type = *t & 7;
+    int cookie = *t >> 3;
+    if (type != TYPE_NUMBER || cookie == TYPE_NUMBER_REAL) {
+        invalid_stream(L,rd);
+    }
+    int64_t n = get_integer(L, rd, cookie);
+    if (n < 0 || n > INT32_MAX) {
+        invalid_stream(L,rd);
+    }
+    return (int)n;
+}
 
-static void
-unpack_table(lua_State *L, struct reader *rd, int array_size) {
-    if (array_size == MAX_COOKIE-1) {
-        uint8_t type = 0;
-        const uint8_t *t = reader_read(rd, sizeof(type));
-        if (t == NULL) {
-            invalid_stream(L,rd);
-        }
-        type = *t;
-        int cookie = type >> 3;
-        if ((type & 7) != TYPE_NUMBER || cookie == TYPE_NUMBER_REAL) {
+static int
+get_array_size(lua_State *L, struct reader *rd, int cookie) {
+    if (cookie != MAX_COOKIE-1)
+        return cookie;
+    return get_count(L, rd);
+}
+
+static uint32_t
+get_string_length(lua_State *L, struct reader *rd, int cookie) {
+    if (cookie == 2) {
+        const uint16_t *plen = reader_read(rd, 2);
+        if (plen == NULL) {
             invalid_stream(L,rd);
         }
-        array_size = get_integer(L, rd, cookie);
+        uint16_t n;
+        memcpy(&n, plen, sizeof(n));
+        CONVERT(n);
+        return n;
     }
+    if (cookie != 4) {
+        invalid_stream(L,rd);
+    }
+    const uint32_t *plen = reader_read(rd, 4);
+    if (plen == NULL) {
+        invalid_stream(L,rd);
+    }
+    uint32_t n;
+    memcpy(&n, plen, sizeof(n));
+    CONVERT(n);
+    return n;
+}
+
+static void unpack_one(lua_State *L, struct reader *rd);
+
+static void
+unpack_table(lua_State *L, struct reader *rd, int array_size) {
+    array_size = get_array_size(L, rd, array_size);
     luaL_checkstack(L,LUA_MINSTACK,NULL);
-    lua_createtable(L,array_size,0);
+    // every element takes at least one byte, so don't trust the header beyond that
+    lua_createtable(L, (size_t)array_size <= rd->len ? array_size : (int)rd->len, 0);
     int i;
     for (i=1;i<=array_size;i++) {
         unpack_one(L,rd);
@@ -373,6 +680,36 @@ unpack_table(lua_State *L, struct reader *rd, int array_size) {
     }
 }
 
+static void
+unpack_codec(lua_State *L, struct reader *rd, int cookie) {
+    int tag = get_count(L, rd);
+    const struct codec *c = codec_push_metatable(L, tag);
+    if (c == NULL) {
+        luaL_error(L, "Unregistered serialize tag %d", tag);
+    }
+
+    const uint8_t *t = reader_read(rd, sizeof(uint8_t));
+    if (t == NULL) {
+        invalid_stream(L,rd);
+    }
+    int type = *t & 7;
+    if (cookie == TYPE_USERDATA_TABLE && type == TYPE_TABLE) {
+        unpack_table(L, rd, *t >> 3);
+    } else if (cookie == TYPE_USERDATA_NATIVE && c->decode != NULL &&
+            (type == TYPE_SHORT_STRING || type == TYPE_LONG_STRING)) {
+        uint32_t len = type == TYPE_SHORT_STRING ? (uint32_t)(*t >> 3) : get_string_length(L, rd, *t >> 3);
+        const char *data = reader_read(rd, len);
+        if (data == NULL || c->decode(L, data, len) != 0) {
+            invalid_stream(L,rd);
+        }
+    } else {
+        invalid_stream(L,rd);
+    }
+    lua_pushvalue(L, -2);
+    lua_setmetatable(L, -2);
+    lua_remove(L, -2);
+}
+
 static void
 push_value(lua_State *L, struct reader *rd, int type, int cookie) {
     switch(type) {
@@ -397,35 +734,17 @@ push_value(lua_State *L, struct reader *rd, int type, int cookie) {
     case TYPE_SHORT_STRING:
         get_buffer(L,rd,cookie);
         break;
-    case TYPE_LONG_STRING: {
-        if (cookie == 2) {
-            const uint16_t *plen = reader_read(rd, 2);
-            if (plen == NULL) {
-                invalid_stream(L,rd);
-            }
-            uint16_t n;
-            memcpy(&n, plen, sizeof(n));
-            CONVERT(n);
-            get_buffer(L,rd,n);
-        } else {
-            if (cookie != 4) {
-                invalid_stream(L,rd);
-            }
-            const uint32_t *plen = reader_read(rd, 4);
-            if (plen == NULL) {
-                invalid_stream(L,rd);
-            }
-            uint32_t n;
-            memcpy(&n, plen, sizeof(n));
-            CONVERT(n);
-            get_buffer(L,rd,n);
-        }
+    case TYPE_LONG_STRING:
+        get_buffer(L,rd,get_string_length(L,rd,cookie));
         break;
-    }
     case TYPE_TABLE: {
         unpack_table(L,rd,cookie);
         break;
     }
+    case TYPE_USERDATA: {
+        unpack_codec(L,rd,cookie);
+        break;
+    }
     default: {
         invalid_stream(L,rd);
         break;
@@ -442,10 +761,173 @@ unpack_one(lua_State *L, struct reader *rd) {
     push_value(L, rd, *t & 0x7, *t >> 3);
 }
 
-int from_bin(lua_State *L) {
+#define COST_TABLE 56
+#define COST_ARRAY_SLOT 16
+#define COST_HASH_NODE 32
+#define COST_STRING 24
+
+enum {
+    INSPECT_ELEMENTS,
+    INSPECT_DEPTH,
+    INSPECT_STRINGS,
+    INSPECT_TABLES,
+    INSPECT_MEMORY,
+    INSPECT_COUNT
+};
+
+static const char *inspect_fields[INSPECT_COUNT] = {
+    "elements", "depth", "strings", "tables", "memory"
+};
+
+struct inspect {
+    int64_t v[INSPECT_COUNT];
+};
+
+inline static void
+check_limits(lua_State *L, const struct inspect *st, const struct inspect *lim) {
+    if (lim == NULL)
+        return;
+    for (int i = 0; i < INSPECT_COUNT; ++i) {
+        if (lim->v[i] >= 0 && st->v[i] > lim->v[i])
+            luaL_error(L, "Serialize stream exceeds %s limit", inspect_fields[i]);
+    }
+}
+
+static void
+get_limits(lua_State *L, int index, struct inspect *lim) {
+    luaL_checktype(L, index, LUA_TTABLE);
+    for (int i = 0; i < INSPECT_COUNT; ++i) {
+        lua_getfield(L, index, inspect_fields[i]);
+        if (lua_isnil(L, -1)) {
+            lim->v[i] = -1;
+        } else if (lua_type(L, -1) == LUA_TNUMBER && lua_isinteger(L, -1)) {
+            lim->v[i] = (int64_t)lua_tointeger(L, -1);
+        } else {
+            luaL_error(L, "limit %s must be an integer", inspect_fields[i]);
+        }
+        lua_pop(L, 1);
+    }
+}
+
+static void inspect_value(lua_State *L, struct reader *rd, struct inspect *st,
+    const struct inspect *lim, int type, int cookie, int depth);
+
+static int
+inspect_one(lua_State *L, struct reader *rd, struct inspect *st, const struct inspect *lim, int depth) {
+    const uint8_t *t = reader_read(rd, sizeof(uint8_t));
+    if (t==NULL) {
+        invalid_stream(L, rd);
+    }
+    inspect_value(L, rd, st, lim, *t & 0x7, *t >> 3, depth);
+    return *t;
+}
+
+static void
+inspect_table(lua_State *L, struct reader *rd, struct inspect *st, const struct inspect *lim, int array_size, int depth) {
+    if (depth > MAX_DEPTH + 1) {
+        luaL_error(L, "serialize can't unpack too depth table");
+    }
+    array_size = get_array_size(L, rd, array_size);
+    st->v[INSPECT_TABLES]++;
+    if (depth > st->v[INSPECT_DEPTH])
+        st->v[INSPECT_DEPTH] = depth;
+    st->v[INSPECT_MEMORY] += COST_TABLE + (int64_t)array_size * COST_ARRAY_SLOT;
+    check_limits(L, st, lim);
+
+    for (int i = 1; i <= array_size; i++) {
+        inspect_one(L, rd, st, lim, depth);
+    }
+    for (;;) {
+        const uint8_t *t = reader_read(rd, sizeof(uint8_t));
+        if (t==NULL) {
+            invalid_stream(L, rd);
+        }
+        if ((*t & 0x7) == TYPE_NIL)
+            return;
+        inspect_value(L, rd, st, lim, *t & 0x7, *t >> 3, depth);
+        inspect_one(L, rd, st, lim, depth);
+        st->v[INSPECT_MEMORY] += COST_HASH_NODE;
+    }
+}
+
+static void
+inspect_value(lua_State *L, struct reader *rd, struct inspect *st,
+        const struct inspect *lim, int type, int cookie, int depth) {
+    st->v[INSPECT_ELEMENTS]++;
+    switch(type) {
+    case TYPE_NIL:
+    case TYPE_BOOLEAN:
+        break;
+    case TYPE_NUMBER:
+        if (cookie == TYPE_NUMBER_REAL) {
+            get_real(L,rd);
+        } else {
+            get_integer(L,rd,cookie);
+        }
+        break;
+    case TYPE_SHORT_STRING:
+    case TYPE_LONG_STRING: {
+        uint32_t len = type == TYPE_SHORT_STRING ? (uint32_t)cookie : get_string_length(L,rd,cookie);
+        if (reader_read(rd, len) == NULL) {
+            invalid_stream(L,rd);
+        }
+        st->v[INSPECT_STRINGS] += len;
+        st->v[INSPECT_MEMORY] += COST_STRING + len + 1;
+        break;
+    }
+    case TYPE_TABLE:
+        inspect_table(L,rd,st,lim,cookie,depth+1);
+        return;
+    case TYPE_USERDATA: {
+        // counted once, with its payload
+        st->v[INSPECT_ELEMENTS]--;
+        get_count(L,rd);
+        int t = inspect_one(L,rd,st,lim,depth) & 7;
+        if (cookie == TYPE_USERDATA_TABLE ? t != TYPE_TABLE : cookie != TYPE_USERDATA_NATIVE ||
+                (t != TYPE_SHORT_STRING && t != TYPE_LONG_STRING)) {
+            invalid_stream(L,rd);
+        }
+        return;
+    }
+    default:
+        invalid_stream(L,rd);
+    }
+    check_limits(L, st, lim);
+}
+
+static void
+inspect_stream(lua_State *L, const char *buffer, size_t len, struct inspect *st, const struct inspect *lim) {
+    struct reader rd;
+    reader_init(&rd, buffer, len);
+    memset(st, 0, sizeof(*st));
+    for (;;) {
+        const uint8_t *t = reader_read(&rd, sizeof(uint8_t));
+        if (!t) break;
+        inspect_value(L, &rd, st, lim, *t & 0x7, *t >> 3, 0);
+    }
+}
+
+int inspect(lua_State *L) {
     size_t len;
     const char *buffer = luaL_checklstring(L, 1, &len);
 
+    struct inspect st;
+    inspect_stream(L, buffer, len, &st, NULL);
+
+    for (int i = 0; i < INSPECT_COUNT; ++i) {
+        lua_pushinteger(L, (lua_Integer)st.v[i]);
+    }
+    return INSPECT_COUNT;
+}
+
+static void
+unpack_stream(lua_State *L, const char *buffer, size_t len, int limits) {
+    if (!lua_isnoneornil(L, limits)) {
+        struct inspect st, lim;
+        get_limits(L, limits, &lim);
+        inspect_stream(L, buffer, len, &st, &lim);
+    }
+
     struct reader rd;
     reader_init(&rd, buffer, len);
     for (int i = 0;; ++i) {
@@ -456,6 +938,100 @@ int from_bin(lua_State *L) {
         if (!t) break;
         push_value(L, &rd, *t & 0x7, *t >> 3);
     }
+}
+
+int from_bin(lua_State *L) {
+    size_t len;
+    const char *buffer = luaL_checklstring(L, 1, &len);
+    lua_settop(L, 2);
+
+    unpack_stream(L, buffer, len, 2);
+
+    return lua_gettop(L) - 2;
+}
 
-    return lua_gettop(L) - 1;
+// frame: magic(2) | payload length(4) | crc32c of payload(4) | payload
+#define FRAME_MAGIC "\xc5\xe1"
+#define FRAME_HEADER 10
+
+int to_frame(lua_State *L) {
+    struct buffer bf;
+    buffer_initialize(&bf, L);
+    STAT_BEGIN(&bf);
+
+    char header[FRAME_HEADER] = FRAME_MAGIC;
+    buffer_append(&bf, header, FRAME_HEADER);
+    buffer_crc_begin(&bf);
+
+    for (int i = 1; i <= lua_gettop(L); ++i) {
+        pack_one(L, &bf, i, 0, 0);
+    }
+
+    uint32_t size = (uint32_t)(buffer_size(&bf) - FRAME_HEADER);
+    uint32_t crc = buffer_crc(&bf);
+    CONVERT(size);
+    CONVERT(crc);
+    memcpy(bf.head->data + 2, &size, sizeof(size));
+    memcpy(bf.head->data + 6, &crc, sizeof(crc));
+
+    buffer_push_string(&bf);
+    buffer_free(&bf);
+    STAT_END(&bf);
+
+    return 1;
+}
+
+// returns the payload size of the frame at p, or -1 if it isn't a valid frame
+static int64_t
+check_frame(const char *p, size_t len) {
+    if (len < FRAME_HEADER || memcmp(p, FRAME_MAGIC, 2) != 0)
+        return -1;
+    uint32_t size, crc;
+    memcpy(&size, p + 2, sizeof(size));
+    memcpy(&crc, p + 6, sizeof(crc));
+    CONVERT(size);
+    CONVERT(crc);
+    if (size > len - FRAME_HEADER || crc32c_update(0, p + FRAME_HEADER, size) != crc)
+        return -1;
+    return size;
+}
+
+static size_t
+check_position(lua_State *L, int index, size_t len) {
+    lua_Integer pos = luaL_optinteger(L, index, 1);
+    luaL_argcheck(L, pos >= 1 && (size_t)pos <= len + 1, index, "position out of range");
+    return (size_t)pos - 1;
+}
+
+int from_frame(lua_State *L) {
+    size_t len;
+    const char *buffer = luaL_checklstring(L, 1, &len);
+    size_t pos = check_position(L, 2, len);
+    lua_settop(L, 3);
+
+    int64_t size = check_frame(buffer + pos, len - pos);
+    if (size < 0) {
+        luaL_error(L, "Invalid serialize frame at %d", (int)pos + 1);
+    }
+    lua_pushinteger(L, (lua_Integer)(pos + FRAME_HEADER + size + 1));
+    unpack_stream(L, buffer + pos + FRAME_HEADER, (size_t)size, 3);
+
+    return lua_gettop(L) - 3;
+}
+
+int next_frame(lua_State *L) {
+    size_t len;
+    const char *buffer = luaL_checklstring(L, 1, &len);
+    size_t pos = check_position(L, 2, len);
+
+    const char *p = buffer + pos, *end = buffer + len;
+    while ((p = memchr(p, FRAME_MAGIC[0], end - p)) != NULL) {
+        if (check_frame(p, end - p) >= 0) {
+            lua_pushinteger(L, (lua_Integer)(p - buffer + 1));
+            return 1;
+        }
+        ++p;
+    }
+    lua_pushnil(L);
+    return 1;
 }
@@ -1,5 +1,7 @@
 #include <string.h>
 #include "buffer.h"
+#include "crc32c.h"
+#include "stats.h"
 
 void buffer_initialize(struct buffer *b, lua_State *L) {
     b->L = L;
@@ -8,19 +10,41 @@ void buffer_initialize(struct buffer *b, lua_State *L) {
     b->head->len = INITIAL_SIZE;
     b->head->next = NULL;
     b->curr = b->head;
+    b->crc = 0;
+    b->crc_p = -1;
+    b->sink = NULL;
+    b->sink_ud = NULL;
+    b->held = NULL;
+#ifdef CSERI_STATS
+    b->stats = stats_of(L);
+#endif
 }
 
 static struct block *_buffer_new_block(struct buffer *b) {
+    STAT_CLOCK(start);
     void *ud;
     lua_Alloc alloc = lua_getallocf(b->L, &ud);
     struct block *res = (struct block*)alloc(ud, NULL, 0, b->curr->len * 2 + sizeof(struct block));
     res->p = 0;
     res->len = b->curr->len * 2;
     res->next = NULL;
+    STAT_ADD(b, blocks, 1);
+    STAT_MAX(b, max_block, res->len);
+    STAT_ELAPSED(b, block_cycles, start);
     return res;
 }
 
-void buffer_append(struct buffer *b, const char *data, size_t len) {
+// passes a full block to the crc and the sink
+static void _buffer_done(struct buffer *b, struct block *p) {
+    if (b->crc_p >= 0) {
+        b->crc = crc32c_update(b->crc, p->data + b->crc_p, p->p - b->crc_p);
+        b->crc_p = 0;
+    }
+    if (b->sink)
+        b->sink(b->sink_ud, p->data, p->p);
+}
+
+void _buffer_append(struct buffer *b, const char *data, size_t len) {
     size_t space = b->curr->len - b->curr->p;
     while (space < len) {
         if (space > 0) {
@@ -29,13 +53,27 @@ void buffer_append(struct buffer *b, const char *data, size_t len) {
             b->curr->p += space;
             len -= space;
         }
-        b->curr = b->curr->next = _buffer_new_block(b);
+        if (b->held) {
+            b->curr = b->curr->next = _buffer_new_block(b);
+        } else {
+            _buffer_done(b, b->curr);
+            if (b->sink)
+                b->curr->p = 0;
+            else
+                b->curr = b->curr->next = _buffer_new_block(b);
+        }
         space = b->curr->len;
     }
     memcpy(b->curr->data + b->curr->p, data, len);
     b->curr->p += len;
 }
 
+void buffer_append_buffer(struct buffer *b, const struct buffer *src) {
+    for (const struct block *p = src->head; p; p = p->next) {
+        buffer_append(b, p->data, p->p);
+    }
+}
+
 void buffer_free(struct buffer *b) {
     void *ud;
     lua_Alloc alloc = lua_getallocf(b->L, &ud);
@@ -50,9 +88,12 @@ void buffer_free(struct buffer *b) {
 
 void buffer_push_string(struct buffer *b) {
     size_t size = buffer_size(b);
+    STAT_ADD(b, bytes, size);
     if (size <= INITIAL_SIZE) {
         lua_pushlstring(b->L, b->head->data, size);
     } else {
+        STAT_CLOCK(start);
+        STAT_ADD(b, flatten_bytes, size);
         void *ud;
         lua_Alloc alloc = lua_getallocf(b->L, &ud);
 
@@ -67,5 +108,61 @@ void buffer_push_string(struct buffer *b) {
 
         lua_pushlstring(b->L, str, size);
         alloc(ud, str, size, 0);
+        STAT_ELAPSED(b, flatten_cycles, start);
+    }
+}
+
+void buffer_crc_begin(struct buffer *b) {
+    b->crc = 0;
+    b->crc_p = b->curr->p;
+}
+
+uint32_t buffer_crc(struct buffer *b) {
+    b->crc = crc32c_update(b->crc, b->curr->data + b->crc_p, b->curr->p - b->crc_p);
+    b->crc_p = b->curr->p;
+    return b->crc;
+}
+
+void buffer_sink(struct buffer *b, buffer_sink_func sink, void *ud) {
+    b->sink = sink;
+    b->sink_ud = ud;
+}
+
+void buffer_flush(struct buffer *b) {
+    if (b->sink && b->curr->p > 0) {
+        b->sink(b->sink_ud, b->curr->data, b->curr->p);
+        b->curr->p = 0;
+    }
+}
+
+void buffer_reserve(struct buffer *b, size_t len, struct buffer_mark *m) {
+    static const char zeros[16];
+    b->held = b->curr;
+    m->block = b->curr;
+    m->p = b->curr->p;
+    while (len > 0) {
+        size_t n = len < sizeof(zeros) ? len : sizeof(zeros);
+        buffer_append(b, zeros, n);
+        len -= n;
+    }
+}
+
+void buffer_fill(struct buffer *b, const struct buffer_mark *m, const char *data, size_t len) {
+    struct block *p = m->block;
+    int off = m->p;
+    while (len > 0) {
+        if (off == p->len) {
+            p = p->next;
+            off = 0;
+        }
+        size_t n = (size_t)(p->len - off) < len ? (size_t)(p->len - off) : len;
+        memcpy(p->data + off, data, n);
+        data += n;
+        off += n;
+        len -= n;
     }
+    // the blocks filled meanwhile are done, curr is still being written
+    for (p = b->held; p != b->curr; p = p->next)
+        _buffer_done(b, p);
+    b->held = NULL;
 }
@@ -2,6 +2,8 @@
 #define _BUFFER_H_
 
 #include <lua.h>
+#include <stdint.h>
+#include <string.h>
 
 #define INITIAL_SIZE 1024
 
@@ -12,10 +14,28 @@ struct block {
     char data[];
 };
 
+// bytes reserved by buffer_reserve
+struct buffer_mark {
+    struct block *block;
+    int p;
+};
+
+struct stats_state;
+
+typedef void (*buffer_sink_func)(void *ud, const char *data, size_t len);
+
 struct buffer {
     lua_State *L;
     struct block *head;
     struct block *curr;
+    uint32_t crc;
+    int crc_p; // offset in curr the crc is computed up to, -1 if disabled
+    buffer_sink_func sink; // if set, full blocks are passed to it and reused
+    void *sink_ud;
+    struct block *held; // the first block kept from the crc and the sink until buffer_fill, or NULL
+#ifdef CSERI_STATS
+    struct stats_state *stats;
+#endif
     struct {
         int p;
         int len;
@@ -25,9 +45,33 @@ struct buffer {
 };
 
 void buffer_initialize(struct buffer *b, lua_State *L);
-void buffer_append(struct buffer *b, const char *data, size_t len);
+void _buffer_append(struct buffer *b, const char *data, size_t len);
 void buffer_free(struct buffer *b);
 void buffer_push_string(struct buffer *b);
+void buffer_append_buffer(struct buffer *b, const struct buffer *src);
+void buffer_crc_begin(struct buffer *b);
+uint32_t buffer_crc(struct buffer *b);
+void buffer_sink(struct buffer *b, buffer_sink_func sink, void *ud);
+void buffer_flush(struct buffer *b);
+
+/*
+ * Appends len bytes to be written by buffer_fill once they are known, such as
+ * a length prefix. Until then, blocks are kept from the crc and the sink. Only
+ * one reservation may be pending at a time.
+ */
+void buffer_reserve(struct buffer *b, size_t len, struct buffer_mark *m);
+void buffer_fill(struct buffer *b, const struct buffer_mark *m, const char *data, size_t len);
+
+// most appends are a few bytes that fit the current block
+inline static void buffer_append(struct buffer *b, const char *data, size_t len) {
+    struct block *curr = b->curr;
+    if ((size_t)(curr->len - curr->p) >= len) {
+        memcpy(curr->data + curr->p, data, len);
+        curr->p += (int)len;
+    } else {
+        _buffer_append(b, data, len);
+    }
+}
 
 inline static void buffer_append_char(struct buffer *b, char c) {
     buffer_append(b, &c, 1);
@@ -0,0 +1,119 @@
+#include <lauxlib.h>
+#include <stdint.h>
+#include "buffer.h"
+#include "codec.h"
+
+/*
+ * registry[CODECS_KEY] maps metatables to codecs and tags to metatables. The key
+ * is a string so that cseri and cseri_raw share it.
+ */
+#define CODECS_KEY "cseri.codecs"
+
+static int
+push_codecs(lua_State *L, int create) {
+    lua_getfield(L, LUA_REGISTRYINDEX, CODECS_KEY);
+    if (lua_istable(L, -1))
+        return 1;
+    lua_pop(L, 1);
+    if (!create)
+        return 0;
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, CODECS_KEY);
+    return 1;
+}
+
+const struct codec *codec_of(lua_State *L, int index) {
+    if (!lua_getmetatable(L, index))
+        return NULL;
+    if (!push_codecs(L, 0)) {
+        lua_pop(L, 1);
+        return NULL;
+    }
+    lua_pushvalue(L, -2);
+    lua_rawget(L, -2);
+    // still referenced by the codecs table after popping
+    const struct codec *c = (const struct codec *)lua_touserdata(L, -1);
+    lua_pop(L, 3);
+    return c;
+}
+
+const struct codec *codec_push_metatable(lua_State *L, int tag) {
+    if (!push_codecs(L, 0))
+        return NULL;
+    lua_rawgeti(L, -1, tag);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 2);
+        return NULL;
+    }
+    lua_pushvalue(L, -1);
+    lua_rawget(L, -3);
+    const struct codec *c = (const struct codec *)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    lua_remove(L, -2);
+    return c;
+}
+
+void codec_register(lua_State *L, int mt, int tag, cseri_encoder encode, cseri_decoder decode) {
+    if (mt < 0 && mt > LUA_REGISTRYINDEX) {
+        mt = lua_gettop(L) + mt + 1;
+    }
+    push_codecs(L, 1);
+
+    lua_rawgeti(L, -1, tag);
+    if (!lua_isnil(L, -1)) {
+        lua_pushnil(L);
+        lua_rawset(L, -3);
+    } else {
+        lua_pop(L, 1);
+    }
+
+    lua_pushvalue(L, mt);
+    lua_rawget(L, -2);
+    const struct codec *old = (const struct codec *)lua_touserdata(L, -1);
+    if (old) {
+        lua_pushnil(L);
+        lua_rawseti(L, -3, old->tag);
+    }
+    lua_pop(L, 1);
+
+    lua_pushvalue(L, mt);
+    struct codec *c = (struct codec *)lua_newuserdata(L, sizeof(*c));
+    c->tag = tag;
+    c->encode = encode;
+    c->decode = decode;
+    lua_rawset(L, -3);
+
+    lua_pushvalue(L, mt);
+    lua_rawseti(L, -2, tag);
+    lua_pop(L, 1);
+}
+
+int register_codec(lua_State *L) {
+    lua_Integer tag = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, tag >= 0 && tag <= INT32_MAX, 1, "tag out of range");
+    luaL_checktype(L, 2, LUA_TTABLE);
+    // nothing can tell a light userdata from a function pointer, so native codecs are registered from C only
+    luaL_argcheck(L, lua_isnoneornil(L, 3), 3, "native codecs must be registered from C");
+    luaL_argcheck(L, lua_isnoneornil(L, 4), 4, "native codecs must be registered from C");
+
+    codec_register(L, 2, (int)tag, NULL, NULL);
+    return 0;
+}
+
+// buffer_append is inline, the table needs its address
+static void
+append(struct buffer *b, const char *data, size_t len) {
+    buffer_append(b, data, len);
+}
+
+static const struct cseri_api api = {
+    CSERI_API_VERSION,
+    codec_register,
+    append,
+};
+
+void codec_publish(lua_State *L) {
+    lua_pushlightuserdata(L, (void *)&api);
+    lua_setfield(L, LUA_REGISTRYINDEX, CSERI_API_KEY);
+}
@@ -0,0 +1,24 @@
+#ifndef _CODEC_H_
+#define _CODEC_H_
+
+#include "cseri.h"
+
+struct codec {
+    int tag;
+    cseri_encoder encode;
+    cseri_decoder decode;
+};
+
+// Returns the codec registered for the metatable of the object at index, or NULL
+const struct codec *codec_of(lua_State *L, int index);
+
+// Pushes the metatable registered with tag and returns its codec, or returns NULL
+const struct codec *codec_push_metatable(lua_State *L, int tag);
+
+// See cseri_api.register_codec
+void codec_register(lua_State *L, int mt, int tag, cseri_encoder encode, cseri_decoder decode);
+
+// Sets registry[CSERI_API_KEY]
+void codec_publish(lua_State *L);
+
+#endif //_CODEC_H_
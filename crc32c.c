@@ -0,0 +1,120 @@
+#include <stdlib.h>
+#include <string.h>
+#include "crc32c.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define CRC32C_SSE42
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARM
+#endif
+
+#define POLY 0x82f63b78
+
+typedef uint32_t (*crc32c_func)(uint32_t crc, const unsigned char *p, size_t len);
+
+static uint32_t table[8][256];
+
+static uint32_t
+crc32c_sw(uint32_t crc, const unsigned char *p, size_t len) {
+    while (len >= 8) {
+        crc ^= p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+        crc = table[7][crc & 0xff] ^ table[6][(crc >> 8) & 0xff] ^
+              table[5][(crc >> 16) & 0xff] ^ table[4][crc >> 24] ^
+              table[3][p[4]] ^ table[2][p[5]] ^ table[1][p[6]] ^ table[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef CRC32C_SSE42
+
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32c_hw(uint32_t crc, const unsigned char *p, size_t len) {
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        crc64 = _mm_crc32_u64(crc64, w);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (len >= 4) {
+        uint32_t w;
+        memcpy(&w, p, sizeof(w));
+        crc = _mm_crc32_u32(crc, w);
+        p += 4;
+        len -= 4;
+    }
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+#elif defined(CRC32C_ARM)
+
+static uint32_t
+crc32c_hw(uint32_t crc, const unsigned char *p, size_t len) {
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        crc = __crc32cd(crc, w);
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+
+#endif
+
+static crc32c_func
+crc32c_resolve(void) {
+    // CSERI_CRC32C_SW=1 forces the table path, so the tests cover it on any host
+    const char *sw = getenv("CSERI_CRC32C_SW");
+    if (sw == NULL || *sw == '\0') {
+#ifdef CRC32C_SSE42
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.2"))
+            return crc32c_hw;
+#elif defined(CRC32C_ARM)
+        return crc32c_hw;
+#endif
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k)
+            c = c & 1 ? (c >> 1) ^ POLY : c >> 1;
+        table[0][i] = c;
+    }
+    for (int i = 0; i < 256; ++i) {
+        for (int k = 1; k < 8; ++k)
+            table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+    }
+    return crc32c_sw;
+}
+
+static crc32c_func func;
+
+// resolved when the library is loaded, before any thread can call crc32c_update
+__attribute__((constructor))
+static void
+crc32c_init(void) {
+    func = crc32c_resolve();
+}
+
+uint32_t crc32c_update(uint32_t crc, const char *data, size_t len) {
+    return ~func(~crc, (const unsigned char *)data, len);
+}
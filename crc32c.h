@@ -0,0 +1,10 @@
+#ifndef _CRC32C_H_
+#define _CRC32C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// crc is the result of the previous call, 0 for the first one
+uint32_t crc32c_update(uint32_t crc, const char *data, size_t len);
+
+#endif //_CRC32C_H_
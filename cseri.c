@@ -4,14 +4,39 @@
 int to_bin(lua_State *L);
 int from_bin(lua_State *L);
 int to_txt(lua_State *L);
+int to_canonical_bin(lua_State *L);
+int to_canonical_txt(lua_State *L);
+int hash(lua_State *L);
+int register_codec(lua_State *L);
+int stats(lua_State *L);
+int inspect(lua_State *L);
+int to_frame(lua_State *L);
+int from_frame(lua_State *L);
+int next_frame(lua_State *L);
+void codec_publish(lua_State *L);
 
-LUA_API int luaopen_cseri(lua_State *L) {
+// the internals flavor is also built as cseri_raw, to compare the two
+#ifndef CSERI_OPEN
+#define CSERI_OPEN luaopen_cseri
+#endif
+
+LUA_API int CSERI_OPEN(lua_State *L) {
     luaL_Reg l[] = {
         {"tobin", to_bin},
         {"frombin", from_bin},
         {"totxt", to_txt},
+        {"canonbin", to_canonical_bin},
+        {"canontxt", to_canonical_txt},
+        {"hash", hash},
+        {"register", register_codec},
+        {"stats", stats},
+        {"inspect", inspect},
+        {"toframe", to_frame},
+        {"fromframe", from_frame},
+        {"nextframe", next_frame},
         {NULL, NULL}
     };
+    codec_publish(L);
 #if LUA_VERSION_NUM < 502
     luaL_register(L, "cseri", l);
 #else
@@ -0,0 +1,49 @@
+#ifndef _CSERI_H_
+#define _CSERI_H_
+
+#include <stddef.h>
+#include <lua.h>
+
+/*
+ * C modules don't link against cseri, they call the loaded library through the
+ * function table it keeps in registry[CSERI_API_KEY] as a light userdata.
+ */
+#define CSERI_API_KEY "cseri.api"
+#define CSERI_API_VERSION 1
+
+struct buffer;
+
+/*
+ * Writes the value at index into b with cseri_api.append. Returns 0 on
+ * success. It must not raise errors since b would leak.
+ */
+typedef int (*cseri_encoder)(lua_State *L, int index, struct buffer *b);
+
+/*
+ * Pushes the value encoded in data. Returns 0 on success. The metatable it was
+ * registered with is set afterwards.
+ */
+typedef int (*cseri_decoder)(lua_State *L, const char *data, size_t len);
+
+struct cseri_api {
+    int version;
+    /*
+     * Serializes the objects having the metatable at index mt with tag. If
+     * encode and decode are NULL, they must be tables and are serialized as
+     * usual. Registering a tag or a metatable again replaces the previous
+     * registration.
+     */
+    void (*register_codec)(lua_State *L, int mt, int tag, cseri_encoder encode, cseri_decoder decode);
+    // Appends len bytes of data to b
+    void (*append)(struct buffer *b, const char *data, size_t len);
+};
+
+// Returns the table of the loaded cseri, or NULL if it isn't loaded or has another version
+inline static const struct cseri_api *cseri_api(lua_State *L) {
+    lua_getfield(L, LUA_REGISTRYINDEX, CSERI_API_KEY);
+    const struct cseri_api *api = (const struct cseri_api *)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return api && api->version == CSERI_API_VERSION ? api : NULL;
+}
+
+#endif //_CSERI_H_
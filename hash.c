@@ -0,0 +1,117 @@
+#include <string.h>
+#include "hash.h"
+
+#define P1 11400714785074694791ULL
+#define P2 14029467366897019727ULL
+#define P3 1609587929392839161ULL
+#define P4 9650029242287828579ULL
+#define P5 2870177450012600261ULL
+
+#define ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+inline static uint64_t
+read64(const unsigned char *p) {
+    return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+           (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+inline static uint32_t
+read32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+inline static uint64_t
+round64(uint64_t acc, uint64_t input) {
+    acc += input * P2;
+    acc = ROTL(acc, 31);
+    return acc * P1;
+}
+
+inline static uint64_t
+merge64(uint64_t acc, uint64_t val) {
+    acc ^= round64(0, val);
+    return acc * P1 + P4;
+}
+
+inline static void
+stripe(uint64_t *v, const unsigned char *p) {
+    v[0] = round64(v[0], read64(p));
+    v[1] = round64(v[1], read64(p + 8));
+    v[2] = round64(v[2], read64(p + 16));
+    v[3] = round64(v[3], read64(p + 24));
+}
+
+void hash64_init(struct hash64 *h, uint64_t seed) {
+    h->v[0] = seed + P1 + P2;
+    h->v[1] = seed + P2;
+    h->v[2] = seed;
+    h->v[3] = seed - P1;
+    h->seed = seed;
+    h->total = 0;
+    h->memsize = 0;
+}
+
+void hash64_update(struct hash64 *h, const char *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    h->total += len;
+
+    if (h->memsize + len < 32) {
+        memcpy(h->mem + h->memsize, p, len);
+        h->memsize += len;
+        return;
+    }
+    if (h->memsize > 0) {
+        size_t fill = 32 - h->memsize;
+        memcpy(h->mem + h->memsize, p, fill);
+        stripe(h->v, h->mem);
+        p += fill;
+        len -= fill;
+        h->memsize = 0;
+    }
+    while (len >= 32) {
+        stripe(h->v, p);
+        p += 32;
+        len -= 32;
+    }
+    memcpy(h->mem, p, len);
+    h->memsize = len;
+}
+
+uint64_t hash64_digest(const struct hash64 *h) {
+    uint64_t r;
+    if (h->total >= 32) {
+        r = ROTL(h->v[0], 1) + ROTL(h->v[1], 7) + ROTL(h->v[2], 12) + ROTL(h->v[3], 18);
+        for (int i = 0; i < 4; ++i)
+            r = merge64(r, h->v[i]);
+    } else {
+        r = h->seed + P5;
+    }
+    r += h->total;
+
+    const unsigned char *p = h->mem;
+    size_t len = h->memsize;
+    while (len >= 8) {
+        r ^= round64(0, read64(p));
+        r = ROTL(r, 27) * P1 + P4;
+        p += 8;
+        len -= 8;
+    }
+    if (len >= 4) {
+        r ^= (uint64_t)read32(p) * P1;
+        r = ROTL(r, 23) * P2 + P3;
+        p += 4;
+        len -= 4;
+    }
+    while (len > 0) {
+        r ^= (*p++) * P5;
+        r = ROTL(r, 11) * P1;
+        --len;
+    }
+
+    r ^= r >> 33;
+    r *= P2;
+    r ^= r >> 29;
+    r *= P3;
+    r ^= r >> 32;
+    return r;
+}
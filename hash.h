@@ -0,0 +1,20 @@
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// streaming XXH64
+struct hash64 {
+    uint64_t v[4];
+    uint64_t seed;
+    uint64_t total;
+    unsigned char mem[32];
+    size_t memsize;
+};
+
+void hash64_init(struct hash64 *h, uint64_t seed);
+void hash64_update(struct hash64 *h, const char *data, size_t len);
+uint64_t hash64_digest(const struct hash64 *h);
+
+#endif //_HASH_H_
@@ -0,0 +1,135 @@
+#ifndef _RAWTABLE_H_
+#define _RAWTABLE_H_
+
+/*
+ * Reads tables through the internals of Lua, without the stack. Enabled by
+ * defining CSERI_TABLE_INTERNALS with the Lua source directory in the include
+ * path, which must match the Lua the module is loaded into.
+ */
+
+#include <lua.h>
+
+#if defined(CSERI_TABLE_INTERNALS) && (LUA_VERSION_NUM == 503 || LUA_VERSION_NUM == 504)
+#define RAWTABLE
+
+#include <lobject.h>
+#include <ltable.h>
+
+// a boolean, number, string or nil read from a table
+struct raw_scalar {
+    int type;
+    int isint;
+    lua_Integer i;
+    lua_Number n;
+    const char *str;
+    size_t len;
+};
+
+#define raw_table(L, index) ((const Table *)lua_topointer((L), (index)))
+// gco2ts lives in lstate.h, which needs most of the other private headers
+#define raw_tstring(gc) ((const TString *)(gc))
+#define raw_array(t, i) (&(t)->array[(i)])
+#define raw_has_nodes(t) (!isdummy(t))
+#define raw_node_size(t) ((unsigned int)sizenode(t))
+#define raw_node(t, i) gnode((t), (i))
+#define raw_node_value(n) gval(n)
+
+inline static void
+raw_string(struct raw_scalar *s, const TString *ts) {
+    s->type = LUA_TSTRING;
+    s->str = getstr(ts);
+    s->len = tsslen(ts);
+}
+
+inline static void
+raw_number(struct raw_scalar *s, int isint, lua_Integer i, lua_Number n) {
+    s->type = LUA_TNUMBER;
+    s->isint = isint;
+    s->i = i;
+    s->n = n;
+}
+
+inline static void
+raw_boolean(struct raw_scalar *s, int b) {
+    s->type = LUA_TBOOLEAN;
+    s->i = b;
+}
+
+#if LUA_VERSION_NUM == 503
+
+#define raw_asize(t) ((t)->sizearray)
+#define raw_isnil(o) ttisnil(o)
+
+// returns 0 if o isn't a scalar
+inline static int
+raw_value(const TValue *o, struct raw_scalar *s) {
+    switch (ttype(o)) {
+    case LUA_TNIL: s->type = LUA_TNIL; return 1;
+    case LUA_TBOOLEAN: raw_boolean(s, bvalue(o)); return 1;
+    case LUA_TNUMINT: raw_number(s, 1, ivalue(o), 0); return 1;
+    case LUA_TNUMFLT: raw_number(s, 0, 0, fltvalue(o)); return 1;
+    case LUA_TSHRSTR:
+    case LUA_TLNGSTR: raw_string(s, raw_tstring(gcvalue(o))); return 1;
+    default: return 0;
+    }
+}
+
+#define raw_key(n, s) raw_value(gkey(n), (s))
+
+#else
+
+#ifndef isrealasize
+#define isrealasize(t) (!((t)->flags & (1 << 7)))
+#endif
+
+// same as luaH_realasize, which isn't exported
+inline static unsigned int
+raw_asize(const Table *t) {
+    unsigned int size = t->alimit;
+    if (isrealasize(t) || (size & (size - 1)) == 0)
+        return size;
+    size |= (size >> 1);
+    size |= (size >> 2);
+    size |= (size >> 4);
+    size |= (size >> 8);
+    size |= (size >> 16);
+    return size + 1;
+}
+
+#define raw_isnil(o) isempty(o)
+
+// returns 0 if o isn't a scalar
+inline static int
+raw_value(const TValue *o, struct raw_scalar *s) {
+    switch (ttypetag(o)) {
+    case LUA_VNIL:
+    case LUA_VEMPTY:
+    case LUA_VABSTKEY: s->type = LUA_TNIL; return 1;
+    case LUA_VFALSE: raw_boolean(s, 0); return 1;
+    case LUA_VTRUE: raw_boolean(s, 1); return 1;
+    case LUA_VNUMINT: raw_number(s, 1, ivalue(o), 0); return 1;
+    case LUA_VNUMFLT: raw_number(s, 0, 0, fltvalue(o)); return 1;
+    case LUA_VSHRSTR:
+    case LUA_VLNGSTR: raw_string(s, raw_tstring(gcvalue(o))); return 1;
+    default: return 0;
+    }
+}
+
+inline static int
+raw_key(const Node *n, struct raw_scalar *s) {
+    switch (withvariant(keytt(n))) {
+    case LUA_VFALSE: raw_boolean(s, 0); return 1;
+    case LUA_VTRUE: raw_boolean(s, 1); return 1;
+    case LUA_VNUMINT: raw_number(s, 1, keyival(n), 0); return 1;
+    case LUA_VNUMFLT: raw_number(s, 0, 0, keyval(n).n); return 1;
+    case LUA_VSHRSTR:
+    case LUA_VLNGSTR: raw_string(s, raw_tstring(keyval(n).gc)); return 1;
+    default: return 0;
+    }
+}
+
+#endif
+
+#endif
+
+#endif //_RAWTABLE_H_
@@ -0,0 +1,104 @@
+#include <lua.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "sortkeys.h"
+
+static int
+compare_key(const void *pa, const void *pb) {
+    const struct sort_key *a = pa, *b = pb;
+    if (a->type != b->type)
+        return a->type < b->type ? -1 : 1;
+
+    switch (a->type) {
+    case LUA_TBOOLEAN:
+        return (int)(a->i - b->i);
+    case LUA_TNUMBER: {
+        if (a->isint && b->isint)
+            return (a->i > b->i) - (a->i < b->i);
+        lua_Number x = a->isint ? (lua_Number)a->i : a->n;
+        lua_Number y = b->isint ? (lua_Number)b->i : b->n;
+        if (x != y)
+            return x < y ? -1 : 1;
+        return b->isint - a->isint;
+    }
+    default: {
+        int r = memcmp(a->str, b->str, a->len < b->len ? a->len : b->len);
+        if (r != 0)
+            return r;
+        return (a->len > b->len) - (a->len < b->len);
+    }
+    }
+}
+
+int sort_keys(lua_State *L, int index, int array_size, struct sort_key **keys) {
+    int top = lua_gettop(L);
+    int n = 0;
+    lua_pushnil(L);
+    while (lua_next(L, index) != 0) {
+        lua_pop(L, 1);
+        int type = lua_type(L, -1);
+        if (type == LUA_TNUMBER && lua_isinteger(L, -1)) {
+            lua_Integer x = lua_tointeger(L, -1);
+            if (x > 0 && x <= array_size)
+                continue;
+        }
+        if (type != LUA_TBOOLEAN && type != LUA_TNUMBER && type != LUA_TSTRING) {
+            lua_settop(L, top);
+            return -1;
+        }
+        if (n == 0) {
+            lua_newtable(L);
+            lua_insert(L, -2);
+        }
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, top + 1, ++n);
+    }
+    if (n == 0)
+        return 0;
+
+    struct sort_key *k = (struct sort_key *)lua_newuserdata(L, n * sizeof(*k));
+    for (int i = 0; i < n; ++i) {
+        lua_rawgeti(L, top + 1, i + 1);
+        k[i].type = lua_type(L, -1);
+        k[i].ref = i + 1;
+        k[i].isint = 0;
+        k[i].i = 0;
+        k[i].n = 0;
+        k[i].str = NULL;
+        k[i].len = 0;
+        switch (k[i].type) {
+        case LUA_TBOOLEAN:
+            k[i].i = lua_toboolean(L, -1);
+            break;
+        case LUA_TNUMBER:
+            k[i].isint = lua_isinteger(L, -1);
+            if (k[i].isint)
+                k[i].i = lua_tointeger(L, -1);
+            else
+                k[i].n = lua_tonumber(L, -1);
+            break;
+        default:
+            // the string stays alive in the keys table
+            k[i].str = lua_tolstring(L, -1, &k[i].len);
+        }
+        lua_pop(L, 1);
+    }
+    qsort(k, n, sizeof(*k), compare_key);
+
+    *keys = k;
+    return n;
+}
+
+int sequence_length(lua_State *L, int index) {
+    int n = 0;
+    for (;;) {
+        lua_rawgeti(L, index, n + 1);
+        int isnil = lua_isnil(L, -1);
+        lua_pop(L, 1);
+        if (isnil)
+            return n;
+        ++n;
+    }
+}
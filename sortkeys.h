@@ -0,0 +1,31 @@
+#ifndef _SORTKEYS_H_
+#define _SORTKEYS_H_
+
+#include <lua.h>
+#include <stddef.h>
+
+struct sort_key {
+    int type;
+    int ref; // index of the key in the keys table
+    int isint;
+    lua_Integer i;
+    lua_Number n;
+    const char *str;
+    size_t len;
+};
+
+/*
+ * Sorts the keys of the table at index, except the integer keys 1..array_size,
+ * by type and then by value. If there are any, pushes a table holding them and
+ * a userdata holding the sorted array set to *keys, and returns their count.
+ * Returns -1 if a key is neither boolean, number nor string.
+ */
+int sort_keys(lua_State *L, int index, int array_size, struct sort_key **keys);
+
+/*
+ * Returns n where t[1..n] are all non-nil and t[n+1] is nil. Unlike lua_rawlen,
+ * it doesn't depend on how the table is laid out.
+ */
+int sequence_length(lua_State *L, int index);
+
+#endif //_SORTKEYS_H_
@@ -0,0 +1,89 @@
+#include <lauxlib.h>
+#include <string.h>
+#include "stats.h"
+
+#ifdef CSERI_STATS
+
+#define STATS_KEY "cseri.stats"
+
+struct stats_state *stats_of(lua_State *L) {
+    lua_getfield(L, LUA_REGISTRYINDEX, STATS_KEY);
+    struct stats_state *s = (struct stats_state *)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    if (s == NULL) {
+        // referenced by the registry after popping
+        s = (struct stats_state *)lua_newuserdata(L, sizeof(*s));
+        memset(s, 0, sizeof(*s));
+        lua_setfield(L, LUA_REGISTRYINDEX, STATS_KEY);
+    }
+    return s;
+}
+
+void stats_begin(struct stats_state *s) {
+    memset(&s->last, 0, sizeof(s->last));
+    s->last.calls = 1;
+    s->start = stats_clock();
+}
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+void stats_end(struct stats_state *s) {
+    struct stats *total = &s->total, *last = &s->last;
+    last->cycles = stats_clock() - s->start;
+
+    total->calls += last->calls;
+    total->bytes += last->bytes;
+    total->blocks += last->blocks;
+    total->max_block = MAX(total->max_block, last->max_block);
+    total->flatten_bytes += last->flatten_bytes;
+    total->tables += last->tables;
+    total->strings += last->strings;
+    total->max_depth = MAX(total->max_depth, last->max_depth);
+    total->cycles += last->cycles;
+    total->block_cycles += last->block_cycles;
+    total->flatten_cycles += last->flatten_cycles;
+}
+
+#define SET_FIELD(L, s, name) \
+    (lua_pushinteger(L, (lua_Integer)(s)->name), lua_setfield(L, -2, #name))
+
+static void
+set_stats(lua_State *L, const struct stats *s) {
+    SET_FIELD(L, s, calls);
+    SET_FIELD(L, s, bytes);
+    SET_FIELD(L, s, blocks);
+    SET_FIELD(L, s, max_block);
+    SET_FIELD(L, s, flatten_bytes);
+    SET_FIELD(L, s, tables);
+    SET_FIELD(L, s, strings);
+    SET_FIELD(L, s, max_depth);
+    SET_FIELD(L, s, cycles);
+    SET_FIELD(L, s, block_cycles);
+    SET_FIELD(L, s, flatten_cycles);
+}
+
+#endif
+
+int stats(lua_State *L) {
+#ifdef CSERI_STATS
+    static const char *const options[] = {"total", "last", "reset", NULL};
+    int option = luaL_checkoption(L, 1, "total", options);
+    struct stats_state *s = stats_of(L);
+    if (option == 2) {
+        memset(s, 0, sizeof(*s));
+        return 0;
+    }
+
+    // fill the table passed in, so that polling doesn't make garbage
+    if (lua_istable(L, 2)) {
+        lua_settop(L, 2);
+    } else {
+        lua_newtable(L);
+    }
+    set_stats(L, option == 0 ? &s->total : &s->last);
+    return 1;
+#else
+    lua_pushnil(L);
+    return 1;
+#endif
+}
@@ -0,0 +1,73 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+/*
+ * Counters of the serialize calls, compiled in only with CSERI_STATS. Each Lua
+ * state keeps its own in the registry, which the buffers of a call point to.
+ */
+
+#ifdef CSERI_STATS
+
+#include <lua.h>
+#include <stdint.h>
+#include <time.h>
+
+struct stats {
+    uint64_t calls;
+    uint64_t bytes;         // bytes serialized
+    uint64_t blocks;        // blocks allocated by the buffer
+    uint64_t max_block;     // size of the largest block
+    uint64_t flatten_bytes; // bytes copied to make the result string
+    uint64_t tables;
+    uint64_t strings;
+    uint64_t max_depth;
+    uint64_t cycles;        // TSC ticks on x86 with gcc or clang, nanoseconds elsewhere
+    uint64_t block_cycles;  // spent allocating blocks
+    uint64_t flatten_cycles;
+};
+
+struct stats_state {
+    struct stats total;
+    struct stats last;
+    uint64_t start;
+};
+
+// Returns the counters of L, creating them the first time
+struct stats_state *stats_of(lua_State *L);
+void stats_begin(struct stats_state *s);
+void stats_end(struct stats_state *s);
+
+inline static uint64_t
+stats_clock(void) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    // the builtin, as x86intrin.h declares names clashing with text.c
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// b is the buffer of the call
+#define STAT_BEGIN(b) stats_begin((b)->stats)
+#define STAT_END(b) stats_end((b)->stats)
+#define STAT_ADD(b, field, n) ((b)->stats->last.field += (n))
+#define STAT_MAX(b, field, n) do { \
+    if ((uint64_t)(n) > (b)->stats->last.field) (b)->stats->last.field = (n); \
+} while (0)
+#define STAT_CLOCK(var) uint64_t var = stats_clock()
+#define STAT_ELAPSED(b, field, var) ((b)->stats->last.field += stats_clock() - (var))
+
+#else
+
+#define STAT_BEGIN(b) ((void)0)
+#define STAT_END(b) ((void)0)
+#define STAT_ADD(b, field, n) ((void)0)
+#define STAT_MAX(b, field, n) ((void)0)
+#define STAT_CLOCK(var) ((void)0)
+#define STAT_ELAPSED(b, field, var) ((void)0)
+
+#endif
+
+#endif //_STATS_H_
@@ -106,8 +106,165 @@ assert(ok == false and msg == "serialize can't pack too depth table")
 assert(cseri.frombin(cseri.tobin(0x7fffffffffffffff)) == 0x7fffffffffffffff)
 assert(cseri.frombin(cseri.tobin(0xffffffffffffffff)) == 0xffffffffffffffff)
 
+local bin = cseri.tobin({1, 2, {a = "xyz"}}, "abcd")
+local elements, depth, strings, tables = cseri.inspect(bin)
+assert(elements == 7 and depth == 2 and strings == 8 and tables == 2)
+
+local ok, msg = pcall(cseri.frombin, bin, {tables = 1})
+assert(ok == false and msg == "Serialize stream exceeds tables limit")
+local ok, msg = pcall(cseri.frombin, bin, {depth = 1})
+assert(ok == false and msg == "Serialize stream exceeds depth limit")
+local ok, msg = pcall(cseri.frombin, bin, {strings = 7})
+assert(ok == false and msg == "Serialize stream exceeds strings limit")
+local ok, msg = pcall(cseri.frombin, bin, {depth = "2"})
+assert(ok == false and msg == "limit depth must be an integer")
+local t, s = cseri.frombin(bin, {elements = 7, depth = 2, strings = 8, tables = 2})
+assert(t[3].a == "xyz" and s == "abcd")
+
+-- array header claims 0x7fffffff elements
+local ok, msg = pcall(cseri.frombin, "\xfe\x22\x7f\xff\xff\xff")
+assert(ok == false and msg:match("^Invalid serialize stream 6 %(line:%d+%)$"))
+
+-- string headers claim 0xffffff00 and 0x80000000 bytes
+for _, bin in ipairs({"\x25\xff\xff\xff\x00", "\x25\x80\x00\x00\x00abc"}) do
+    local ok, msg = pcall(cseri.frombin, bin)
+    assert(ok == false and msg:match("^Invalid serialize stream 5 %(line:%d+%)$"))
+    local ok, msg = pcall(cseri.frombin, bin, {depth = 1})
+    assert(ok == false and msg:match("^Invalid serialize stream 5 %(line:%d+%)$"))
+    local ok, msg = pcall(cseri.inspect, bin)
+    assert(ok == false and msg:match("^Invalid serialize stream 5 %(line:%d+%)$"))
+end
+
+-- known answers, as frames must be readable by other CRC32C implementations
+local check = "\xc5\xe1\x00\x00\x00\x09\xe3\x06\x92\x83123456789"
+assert(cseri.nextframe(check, 1) == 1)
+assert(cseri.nextframe(check:gsub("\x83", "\x84"), 1) == nil)
+local long = string.rep("0123456789abcdef", 200)
+assert(cseri.toframe(long) == "\xc5\xe1\x00\x00\x0c\x83\xf3\x1c\x8d\x1f\x15\x0c\x80" .. long)
+
+local log = cseri.toframe(t) .. cseri.toframe(1, "two") .. cseri.toframe(deep[1])
+local pos, nt = cseri.fromframe(log)
+assert(compare(t, nt))
+local pos, a, b = cseri.fromframe(log, pos)
+assert(a == 1 and b == "two")
+local third = pos
+local pos, nt = cseri.fromframe(log, pos)
+assert(compare(deep[1], nt) and pos == #log + 1)
+
+local bad = log:sub(1, 20) .. string.char((log:byte(21) + 1) % 256) .. log:sub(22)
+local ok, msg = pcall(cseri.fromframe, bad)
+assert(ok == false and msg == "Invalid serialize frame at 1")
+assert(cseri.nextframe(bad, 2) == #cseri.toframe(t) + 1)
+assert(cseri.nextframe(log, third + 1) == nil)
+
+local t1, t2 = {}, {}
+for i = 1, 100 do t1["k" .. i] = i; t1[i * 1.5] = {x = i, [true] = i} end
+for i = 100, 1, -1 do t2[i * 1.5] = {[true] = i, x = i}; t2["k" .. i] = i end
+t1[1], t2[1] = "one", "one"
+assert(cseri.canonbin(t1) == cseri.canonbin(t2))
+assert(cseri.canontxt(t1) == cseri.canontxt(t2))
+assert(compare(cseri.frombin(cseri.canonbin(t1)), t1))
+assert(compare(load("return " .. cseri.canontxt(t1))(), t1))
+assert(cseri.canontxt({b = 1, a = 2, [2] = 0, [1.5] = 0, [false] = 0, [true] = 0}) ==
+    '{[false]=0,[true]=0,[1.5]=0,[2]=0,a=2,b=1}')
+
+assert(#cseri.hash(t1) == 16 and cseri.hash(t1) == cseri.hash(t2))
+t2.k1 = 0
+assert(cseri.hash(t1) ~= cseri.hash(t2))
+assert(cseri.hash(t) == cseri.hash(cseri.frombin(cseri.canonbin(t))))
+assert(cseri.hash(1, "2") ~= cseri.hash(1, "3"))
+
+local ok, msg = pcall(cseri.canonbin, {[{}] = 1})
+assert(ok == false and msg == "Canonical serialize supports only boolean, number and string keys")
+
+local Point = {}
+Point.__index = Point
+function Point:norm2() return self.x * self.x + self.y * self.y end
+cseri.register(1, Point)
+
+local bin = cseri.tobin({setmetatable({x = 3, y = 4}, Point), 5})
+local nt = cseri.frombin(bin)
+assert(getmetatable(nt[1]) == Point and nt[1]:norm2() == 25 and nt[2] == 5)
+assert(select(4, cseri.inspect(bin)) == 2)
+assert(getmetatable(cseri.frombin(cseri.tobin(setmetatable({}, {})))) == nil)
+
+local Other = {}
+cseri.register(1, Other)
+assert(getmetatable(cseri.frombin(bin)[1]) == Other)
+assert(getmetatable(cseri.frombin(cseri.tobin(setmetatable({}, Point)))) == nil)
+
+cseri.register(2, Point)
+local bin = cseri.tobin(setmetatable({}, Point))
+cseri.register(3, Point)
+local ok, msg = pcall(cseri.frombin, bin)
+assert(ok == false and msg == "Unregistered serialize tag 2")
+
+local ok, msg = pcall(cseri.tobin, io.stdout)
+assert(ok == false and msg == "Unsupport type userdata to serialize")
+
+assert(pcall(cseri.register, 4, {}, cseri.tobin, cseri.frombin) == false)
+
+local testcodec = require "testcodec"
+testcodec.register(4)
+local small, large = testcodec.new(3), testcodec.new(1000)
+local function same(a, b)
+    if getmetatable(a) ~= getmetatable(b) or testcodec.len(a) ~= testcodec.len(b) then
+        return false
+    end
+    for i = 1, testcodec.len(a) do
+        if testcodec.get(a, i) ~= testcodec.get(b, i) then return false end
+    end
+    return true
+end
+
+-- the large payload is encoded in place over several blocks, its length filled afterwards
+local bin = cseri.tobin(small, {v = large, n = 1}, large)
+local a, b, c = cseri.frombin(bin)
+assert(same(a, small) and same(b.v, large) and b.n == 1 and same(c, large))
+local pos, a, b = cseri.fromframe(cseri.toframe(large, {small}))
+assert(same(a, large) and same(b[1], small))
+-- fromframe checks the crc of the blocks held until the length was filled
+for n = 1000, 1030 do
+    local pos, a, b = cseri.fromframe(cseri.toframe(string.rep("x", n), large))
+    assert(pos and #a == n and same(b, large))
+end
+local elements, depth, strings, tables = cseri.inspect(bin)
+assert(elements == 7 and depth == 1 and strings == 8 * 2003 + 2 and tables == 1)
+assert(cseri.hash(large) == cseri.hash(cseri.frombin(cseri.tobin(large))))
+
+-- the payload of a codec claims 0xffffff00 bytes
+local ok, msg = pcall(cseri.frombin, "\x03\x0a\x04\x25\xff\xff\xff\x00")
+assert(ok == false and msg:match("^Invalid serialize stream 8 %(line:%d+%)$"))
+
+testcodec.fail(true, false)
+local ok, msg = pcall(cseri.tobin, small)
+assert(ok == false and msg == "Can't serialize userdata with tag 4")
+testcodec.fail(false, true)
+local ok, msg = pcall(cseri.frombin, cseri.tobin(small))
+assert(ok == false and msg:match("^Invalid serialize stream"))
+testcodec.fail(false, false)
+
+if cseri.stats() then
+    -- over INITIAL_SIZE, so the encoder takes more blocks and flattens them
+    local big = {llstr, {1, 2}, {a = "xyz"}}
+    local size = #cseri.tobin(big)
+    assert(size > 1024)
+    cseri.stats("reset")
+    cseri.tobin(big)
+    local last = cseri.stats("last")
+    assert(last.calls == 1 and last.bytes == size and last.flatten_bytes == size)
+    assert(last.tables == 3 and last.max_depth == 2 and last.strings == 3)
+    assert(last.blocks > 0 and last.max_block >= 2048)
+    assert(math.type == nil or math.type(last.bytes) == "integer")
+    cseri.totxt(big)
+    local total = cseri.stats("total", last)
+    assert(total == last and total.calls == 2 and total.tables == 6)
+    -- kept by this Lua state
+    assert(type(debug.getregistry()["cseri.stats"]) == "userdata")
+end
+
 print("passed")
 
 local bin = cseri.tobin("aaa"):sub(1, 2)
 local ok, msg = pcall(cseri.frombin, bin)
-assert(ok == false and msg == "Invalid serialize stream 1 (line:336)")
+assert(ok == false and msg == "Invalid serialize stream 1 (line:604)")
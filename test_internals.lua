@@ -0,0 +1,122 @@
+-- make test-internals LUA_SRC=path/to/lua/src
+-- cseri_raw is the internals flavor, which must write the same bytes as cseri
+local cseri = require "cseri"
+local cseri_raw = require "cseri_raw"
+
+local function compare(t1, t2)
+    for k, v in pairs(t1) do
+        if type(v) == 'table' then
+            if not compare(v, t2[k]) then
+                return false
+            end
+        else
+            if v ~= t2[k] then
+                return false
+            end
+        end
+    end
+    for k in pairs(t2) do
+        if t1[k] == nil then return false end
+    end
+    return true
+end
+
+-- the same table is given to both, so both read the same layout
+local function same(t)
+    local bin = cseri.tobin(t)
+    assert(cseri_raw.tobin(t) == bin)
+    return bin
+end
+
+local function check(t)
+    local bin = same(t)
+    assert(compare(t, cseri_raw.frombin(bin)))
+    return bin
+end
+
+-- holes in the array part, past the border lua_rawlen returns
+check({1, 2, 3, nil, 5, 6, nil, nil, 9})
+check({nil, nil, 3})
+check({"a", nil, {1}, nil, "long string " .. string.rep("x", 300), nil, 7.5})
+local t = {}
+for i = 1, 100 do
+    t[i] = i % 3 == 0 and {i} or i
+end
+for i = 50, 100, 7 do
+    t[i] = nil
+end
+check(t)
+t[100] = nil
+t[60] = nil
+check(t)
+
+-- in Lua 5.4, # lowers alimit below the size of the array part
+local t = {}
+for i = 1, 16 do
+    t[i] = i
+end
+for i = 10, 16 do
+    t[i] = nil
+end
+assert(#t == 9)
+t[12] = "past the limit"
+check(t)
+t[12] = nil
+assert(#t == 9)
+check(t)
+
+-- the border in the node part
+check({[1] = 1, [2] = 2, [3] = 3})
+check({[1] = {1}, [2] = "a", [3] = 3, x = 1})
+for n = 1, 40 do
+    local t = {}
+    for i = n, 1, -1 do
+        t[i] = i % 2 == 0 and i or {i}
+    end
+    check(t)
+end
+local t = {1, 2, 3}
+t[5], t[4] = 5, 4
+check(t)
+
+-- keys that are tables make the internals resume lua_next
+same({[{}] = 1})
+same({1, 2, 3, [{}] = 1, a = 2})
+same({1, nil, 3, [{1}] = {2}, b = {c = 3}})
+same({[1] = 1, [2] = 2, [{}] = 3})
+local t = {}
+for i = 1, 20 do
+    t[i] = i
+    t[{i}] = i
+end
+same(t)
+
+-- tables in the node part go through the stack
+check({a = {b = {c = 1}}, [1.5] = {}, [true] = {1}, [false] = "f"})
+check({1, 2, x = {y = {}}, [-1] = {1, 2, 3}, [2^53] = {z = "z"}})
+
+-- scalars of every kind in both parts
+check({1, -1, 255, 65535, 2^31, -2^31, 2^53, 1.5, -0.25, true, false, "", string.rep("s", 70000)})
+check({[0] = 0, [-5] = true, [1.5] = false, [""] = "", [string.rep("k", 300)] = 2^40})
+
+-- registered codecs, from Lua and from C
+local Point = {}
+cseri.register(1, Point)
+local p = setmetatable({x = 3, y = 4}, Point)
+local bin = check({p, {p}, at = p})
+assert(getmetatable(cseri_raw.frombin(bin)[1]) == Point)
+same({[p] = 1, p})
+
+local testcodec = require "testcodec"
+testcodec.register(4)
+local v = testcodec.new(3)
+same({v, nil, v, at = v, nested = {v}})
+
+-- both stop at the same depth
+local deep = {}
+for i = 1, 40 do
+    deep = {deep, i}
+end
+local ok, msg = pcall(cseri.tobin, deep)
+local ok_raw, msg_raw = pcall(cseri_raw.tobin, deep)
+assert(ok == false and ok_raw == false and msg == msg_raw)
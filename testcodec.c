@@ -0,0 +1,112 @@
+/*
+ * A userdata codec for test.lua: vectors of doubles registered through the
+ * function table of the loaded cseri.
+ */
+#include <lauxlib.h>
+#include <string.h>
+#include "cseri.h"
+
+#define VECTOR "testcodec.vector"
+
+struct vector {
+    int n;
+    double v[];
+};
+
+static int fail_encode, fail_decode;
+static const struct cseri_api *api;
+
+static struct vector *
+new_vector(lua_State *L, int n) {
+    struct vector *vec = (struct vector *)lua_newuserdata(L, sizeof(*vec) + n * sizeof(double));
+    vec->n = n;
+    luaL_getmetatable(L, VECTOR);
+    lua_setmetatable(L, -2);
+    return vec;
+}
+
+static int
+encode(lua_State *L, int index, struct buffer *b) {
+    if (fail_encode)
+        return 1;
+    const struct vector *vec = (const struct vector *)lua_touserdata(L, index);
+    api->append(b, (const char *)vec->v, vec->n * sizeof(double));
+    return 0;
+}
+
+static int
+decode(lua_State *L, const char *data, size_t len) {
+    if (fail_decode || len % sizeof(double) != 0)
+        return 1;
+    struct vector *vec = new_vector(L, (int)(len / sizeof(double)));
+    memcpy(vec->v, data, len);
+    return 0;
+}
+
+// new(n) makes a vector of n elements, v[i] = i / 2
+static int
+lnew(lua_State *L) {
+    int n = (int)luaL_checkinteger(L, 1);
+    struct vector *vec = new_vector(L, n);
+    for (int i = 0; i < n; ++i)
+        vec->v[i] = i / 2.0;
+    return 1;
+}
+
+static int
+lget(lua_State *L) {
+    const struct vector *vec = (const struct vector *)luaL_checkudata(L, 1, VECTOR);
+    int i = (int)luaL_checkinteger(L, 2);
+    luaL_argcheck(L, i >= 1 && i <= vec->n, 2, "index out of range");
+    lua_pushnumber(L, vec->v[i - 1]);
+    return 1;
+}
+
+static int
+llen(lua_State *L) {
+    const struct vector *vec = (const struct vector *)luaL_checkudata(L, 1, VECTOR);
+    lua_pushinteger(L, vec->n);
+    return 1;
+}
+
+// register(tag) registers the vector metatable with tag
+static int
+lregister(lua_State *L) {
+    int tag = (int)luaL_checkinteger(L, 1);
+    luaL_getmetatable(L, VECTOR);
+    api->register_codec(L, -1, tag, encode, decode);
+    return 0;
+}
+
+// fail(encode, decode) makes the codec fail
+static int
+lfail(lua_State *L) {
+    fail_encode = lua_toboolean(L, 1);
+    fail_decode = lua_toboolean(L, 2);
+    return 0;
+}
+
+LUA_API int luaopen_testcodec(lua_State *L) {
+    luaL_Reg l[] = {
+        {"new", lnew},
+        {"get", lget},
+        {"len", llen},
+        {"register", lregister},
+        {"fail", lfail},
+        {NULL, NULL}
+    };
+    lua_getglobal(L, "require");
+    lua_pushliteral(L, "cseri");
+    lua_call(L, 1, 0);
+    api = cseri_api(L);
+    if (api == NULL)
+        return luaL_error(L, "cseri %d isn't loaded", CSERI_API_VERSION);
+    luaL_newmetatable(L, VECTOR);
+    lua_pop(L, 1);
+#if LUA_VERSION_NUM < 502
+    luaL_register(L, "testcodec", l);
+#else
+    luaL_newlib(L, l);
+#endif
+    return 1;
+}
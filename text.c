@@ -5,6 +5,8 @@
 #include <ctype.h>
 #include "common.h"
 #include "buffer.h"
+#include "sortkeys.h"
+#include "stats.h"
 
 static const char *char2escape[256] = {
     "\\x00", "\\x01", "\\x02", "\\x03",
@@ -70,8 +72,10 @@ append_escape_string(struct buffer *bf, const char *str, size_t len) {
     }
 }
 
+static void _serialize_sorted(lua_State *L, int idx, struct buffer *bf, int depth, int len, bool first);
+
 static void
-_serialize(lua_State *L, int idx, struct buffer *bf, bool is_key, int depth) {
+_serialize(lua_State *L, int idx, struct buffer *bf, bool is_key, int depth, bool sorted) {
     if (depth > MAX_DEPTH) {
         buffer_free(bf);
         luaL_error(L, "serialize can't pack too depth table");
@@ -109,6 +113,7 @@ _serialize(lua_State *L, int idx, struct buffer *bf, bool is_key, int depth) {
         if (is_key) buffer_append_lstr(bf, "]=", 2);
         break;
     case LUA_TSTRING: {
+        STAT_ADD(bf, strings, 1);
         size_t len;
         const char *str = lua_tolstring(L, idx, &len);
         if (is_key) {
@@ -129,11 +134,13 @@ _serialize(lua_State *L, int idx, struct buffer *bf, bool is_key, int depth) {
     }
     case LUA_TTABLE: {
         luaL_checkstack(L, LUA_MINSTACK, NULL);
+        STAT_ADD(bf, tables, 1);
+        STAT_MAX(bf, max_depth, depth + 1);
         if (is_key) buffer_append_char(bf, '[');
         buffer_append_char(bf, '{');
 
         bool first = 1;
-        int len = lua_rawlen(L, idx);
+        int len = sorted ? sequence_length(L, idx) : (int)lua_rawlen(L, idx);
         for (int i = 1; i <= len; ++i) {
             if (first)
                 first = 0;
@@ -141,27 +148,31 @@ _serialize(lua_State *L, int idx, struct buffer *bf, bool is_key, int depth) {
                 buffer_append_char(bf, ',');
             lua_rawgeti(L, idx, i);
             int top = lua_gettop(L);
-            _serialize(L, top, bf, false, depth + 1);
+            _serialize(L, top, bf, false, depth + 1, sorted);
             lua_pop(L, 1);
         }
 
-        lua_pushnil(L);
-        while (lua_next(L, idx)) {
-            if (lua_type(L, -2) == LUA_TNUMBER && lua_isinteger(L, -2)) {
-                lua_Integer i = lua_tointeger(L, -2);
-                if (i > 0 && i <= len) {
-                    lua_pop(L, 1);
-                    continue;
+        if (sorted) {
+            _serialize_sorted(L, idx, bf, depth, len, first);
+        } else {
+            lua_pushnil(L);
+            while (lua_next(L, idx)) {
+                if (lua_type(L, -2) == LUA_TNUMBER && lua_isinteger(L, -2)) {
+                    lua_Integer i = lua_tointeger(L, -2);
+                    if (i > 0 && i <= len) {
+                        lua_pop(L, 1);
+                        continue;
+                    }
                 }
+                if (first)
+                    first = 0;
+                else
+                    buffer_append_char(bf, ',');
+                int top = lua_gettop(L);
+                _serialize(L, top - 1, bf, true, depth + 1, false);
+                _serialize(L, top, bf, false, depth + 1, false);
+                lua_pop(L, 1);
             }
-            if (first)
-                first = 0;
-            else
-                buffer_append_char(bf, ',');
-            int top = lua_gettop(L);
-            _serialize(L, top - 1, bf, true, depth + 1);
-            _serialize(L, top, bf, false, depth + 1);
-            lua_pop(L, 1);
         }
 
         buffer_append_char(bf, '}');
@@ -174,18 +185,55 @@ _serialize(lua_State *L, int idx, struct buffer *bf, bool is_key, int depth) {
     }
 }
 
-int to_txt(lua_State *L) {
+static void
+_serialize_sorted(lua_State *L, int idx, struct buffer *bf, int depth, int len, bool first) {
+    struct sort_key *keys;
+    int n = sort_keys(L, idx, len, &keys);
+    if (n < 0) {
+        buffer_free(bf);
+        luaL_error(L, "Canonical serialize supports only boolean, number and string keys");
+    }
+    int keys_table = lua_gettop(L) - 1;
+    for (int i = 0; i < n; ++i) {
+        if (first)
+            first = 0;
+        else
+            buffer_append_char(bf, ',');
+        lua_rawgeti(L, keys_table, keys[i].ref);
+        lua_pushvalue(L, -1);
+        lua_rawget(L, idx);
+        int top = lua_gettop(L);
+        _serialize(L, top - 1, bf, true, depth + 1, true);
+        _serialize(L, top, bf, false, depth + 1, true);
+        lua_pop(L, 2);
+    }
+    if (n > 0)
+        lua_pop(L, 2);
+}
+
+static int
+_serialize_values(lua_State *L, bool sorted) {
     struct buffer bf;
     buffer_initialize(&bf, L);
+    STAT_BEGIN(&bf);
 
     for (int i = 1; i <= lua_gettop(L); ++i) {
         if (i != 1)
             buffer_append_char(&bf, ',');
-        _serialize(L, i, &bf, false, 0);
+        _serialize(L, i, &bf, false, 0, sorted);
     }
 
     buffer_push_string(&bf);
     buffer_free(&bf);
+    STAT_END(&bf);
 
     return 1;
 }
+
+int to_txt(lua_State *L) {
+    return _serialize_values(L, false);
+}
+
+int to_canonical_txt(lua_State *L) {
+    return _serialize_values(L, true);
+}